@@ -9,7 +9,8 @@
 // Currently only one of ENABLE_READ_INTERRUPTS and ENABLE_WRITE_TIMER can be enabled when ENABLE_MULTICORE is false.
 // Otherwise the interrupts might not trigger for an unknown reason!
 
-// Write timer is currently not supported for PWM output which makes IR timing less accurate
+// IR is sent from the main loop which makes IR timing less accurate.
+// InterruptPWMPinWriter can send IR with the write timer.
 #if defined(ESP8266)
 #define ENABLE_READ_INTERRUPTS 1
 #define ENABLE_WRITE_TIMER 0
@@ -180,6 +181,7 @@ const uint16_t kESIPin = D_10;
 
 #include <map>
 #include <deque>
+#include <vector>
 
 #ifndef INPUT_PULLDOWN
 #define INPUT_PULLDOWN INPUT
@@ -449,13 +451,16 @@ public:
 #if HAVE_SR
     scheduler.add(&_rxNEC, kSRPin, ENABLE_READ_INTERRUPTS);
     scheduler.add(&_rxSIRC, kSRPin, ENABLE_READ_INTERRUPTS);
+    // Only the decoder that recognizes the leader gets the rest of the frame.
+    scheduler.classify(kSRPin);
 #endif
 #if HAVE_SECOND_SR
     scheduler.add(&_rxNEC2, kSR2Pin, ENABLE_READ_INTERRUPTS);
     scheduler.add(&_rxSIRC2, kSR2Pin, ENABLE_READ_INTERRUPTS);
+    scheduler.classify(kSR2Pin);
 #endif
 #if HAVE_IR_455
-    scheduler.add(&_rx455, kIR455ReceivePin, ENABLE_READ_INTERRUPTS);
+    scheduler.add(&_rx455, kIR455ReceivePin, ENABLE_READ_INTERRUPTS, 40);
 #endif
 #if ENABLE_BEO36
     scheduler.add(&_rxBeo36, kIRReceivePin, ENABLE_READ_INTERRUPTS && !ENABLE_IRREMOTE);
@@ -482,6 +487,7 @@ public:
     scheduler.add(&_rxRC5_IR, kIRReceivePin, ENABLE_READ_INTERRUPTS);
     scheduler.add(&_rxNEC_IR, kIRReceivePin, ENABLE_READ_INTERRUPTS);
     scheduler.add(&_rxSIRC_IR, kIRReceivePin, ENABLE_READ_INTERRUPTS);
+    scheduler.classify(kIRReceivePin);
 #endif
 
 #if HAVE_PULSE
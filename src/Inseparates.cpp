@@ -4,9 +4,58 @@
 #include "ProtocolUtils.h"
 #include "PlatformTimers.h"
 
+#if defined(AVR) && !INS_FAST_COUNT
+#include <avr/sleep.h>
+#endif
+
 namespace inseparates
 {
 
+bool Scheduler::idle(uint32_t idleMicros, bool notify)
+{
+	(void)notify;
+#ifdef UNIT_TEST
+	delayMicroseconds(idleMicros);
+	return true;
+#elif defined(ESP32)
+	// Waiting n ticks may return up to one tick early
+	// and another task of the same priority may run up to one more tick.
+	uint32_t ticks = idleMicros / (portTICK_PERIOD_MS * 1000);
+	if (ticks < 3)
+		return false;
+	// Other tasks, like loopTask in run(), may use their notification for something else.
+	if (notify)
+		ulTaskNotifyTake(pdTRUE, ticks - 2);
+	else
+		vTaskDelay(ticks - 2);
+	return true;
+#elif defined(ARDUINO_ARCH_SAMD)
+	// Woken by SysTick every millisecond at the latest.
+	if (idleMicros < 1100)
+		return false;
+	__WFI();
+	return true;
+#elif defined(AVR) && !INS_FAST_COUNT
+	// Woken by the timer 0 overflow every 1024 us at the latest.
+	if (idleMicros < 1100)
+		return false;
+	set_sleep_mode(SLEEP_MODE_IDLE);
+	sleep_enable();
+	sleep_cpu();
+	sleep_disable();
+	return true;
+#elif defined(ESP8266)
+	// Lets the Wi-Fi stack run.
+	if (idleMicros < 2000)
+		return false;
+	delay(1);
+	return true;
+#else
+	(void)idleMicros;
+	return false;
+#endif
+}
+
 void Scheduler::run(SteppedTask *task)
 {
 	uint16_t targetTime = fastMicros();
@@ -16,11 +65,24 @@ void Scheduler::run(SteppedTask *task)
 		delta = task->SteppedTask_step();
 		if (delta == SteppedTask::kInvalidDelta)
 			return;
-		targetTime += delta;
-		int16_t offset = targetTime - fastMicros();
-		if (offset > 0)
+		uint32_t left = task->sleepMicros(delta);
+		while (left)
 		{
-			safeDelayMicros((uint16_t)offset);
+			uint16_t chunk = left > SteppedTask::kMaxSleepMicros ? SteppedTask::kMaxSleepMicros : left;
+			left -= chunk;
+			targetTime += chunk;
+			for (;;)
+			{
+				int16_t offset = targetTime - fastMicros();
+				if (offset <= 0)
+					break;
+				// Sleep for the bulk of long delays and busy wait the rest.
+				if (!idle((uint16_t)offset))
+				{
+					safeDelayMicros((uint16_t)offset);
+					break;
+				}
+			}
 		}
 	}
 }
@@ -35,42 +97,16 @@ void Scheduler::runFor(SteppedTask *task, unsigned steps)
 		delta = task->SteppedTask_step();
 		if (delta == SteppedTask::kInvalidDelta)
 			return;
-		targetTime += delta;
+		targetTime += task->sleepMicros(delta);
 		int32_t offset = targetTime - micros();
 		if (offset > 0)
 		{
-			safeDelayMicros((uint16_t)offset);
+			safeDelayMicros(offset);
 		}
 	}
 }
 #endif
 
-#if !(UNIT_TEST || USE_FUNCTIONAL_INTERRUPT)
-uint8_t Scheduler::PinStatePusher::s_pinUsage[MAX_PIN_CALLBACKS];
-
-INS_IRAM_ATTR void pinISR(uint8_t pinIndex)
-{
-	auto &inputFifo = Scheduler::PinStatePusher::schedulerInstance()->inputFIFO();
-	auto &w = inputFifo.writeRef();
-	w.micros = fastMicros();
-	uint8_t pin = Scheduler::PinStatePusher::s_pinUsage[pinIndex];
-	w.pin = pin;
-	w.state = digitalRead(pin);
-	inputFifo.push();
-}
-
-INS_IRAM_ATTR void pinISR0() { pinISR(0); }
-INS_IRAM_ATTR void pinISR1() { pinISR(1); }
-INS_IRAM_ATTR void pinISR2() { pinISR(2); }
-#ifndef AVR
-INS_IRAM_ATTR void pinISR3() { pinISR(3); }
-INS_IRAM_ATTR void pinISR4() { pinISR(4); }
-INS_IRAM_ATTR void pinISR5() { pinISR(5); }
-INS_IRAM_ATTR void pinISR6() { pinISR(6); }
-INS_IRAM_ATTR void pinISR7() { pinISR(7); }
-#endif
-#endif
-
 #ifdef ARDUINO_ARCH_SAMD
 HWTimer::CallbackFunction HWTimer::s_callback;
 
@@ -101,60 +137,6 @@ extern "C" void TC3_Handler()
 #endif
 #endif
 
-#if (INS_HAVE_HW_TIMER || UNIT_TEST) && INS_OUTPUT_FIFO_CHANNEL_COUNT
-INS_IRAM_ATTR void timerISR()
-{
-	auto *s_this = InterruptWriteScheduler::instance();
-	for (uint8_t i = 0; i < INS_OUTPUT_FIFO_CHANNEL_COUNT; ++i)
-	{
-		static int count;
-		if (!(count%100000))
-		{
-			count = 0;
-		}
-		++count;
-		auto &fifo = s_this->outputFIFO(i);
-		if (fifo.empty())
-		{
-			continue;
-		}
-		ins_micros_t now = fastMicros();
-		auto &r = fifo.readRef();
-		ins_micros_t targetMicros = r.micros;
-		ins_smicros_t timeLeft = targetMicros - now;
-		if (timeLeft > s_this->_pollIntervalMicros / 2)
-		{
-			continue;
-		}
-		uint8_t pin = r.pin;
-		if (pin == (uint8_t)-1)
-		{
-			fifo.pop();
-			continue;
-		}
-		static int count2;
-		if ((count2%100) == 99)
-		{
-			count2 = 0;
-		}
-		++count2;
-		uint8_t state = r.state;
-		uint8_t mode = r.mode;
-		digitalWrite(pin, state);
-		if (mode == OUTPUT)
-		{
-			digitalWrite(pin, state);
-			pinMode(pin, mode);
-		}
-		else
-		{
-			pinMode(pin, OUTPUT);
-		}
-		fifo.pop();
-	}
-}
-#endif
-
 int Serial_printf(const char *format, ...)
 {
 #ifdef UNIT_TEST
@@ -10,10 +10,6 @@
 #endif
 #ifdef UNIT_TEST
 #include <assert.h>
-#elif defined(ESP8266) || defined(ESP32)
-#define USE_FUNCTIONAL_INTERRUPT 0
-#include <functional>
-#include <FunctionalInterrupt.h>
 #endif
 
 #ifndef INS_SEQUENCER_MAX_NUM_TASKS
@@ -50,9 +46,30 @@
 #endif
 #endif
 
-#ifndef AVR
-#include <map>
-#include <memory>
+// Max number of edges passed in one Decoder_pulses() call on pins in batch mode, see Scheduler::batch().
+#ifndef INS_BATCH_LENGTH
+#define INS_BATCH_LENGTH 16
+#endif
+
+// Set to 1 to collect per task and per decoder execution statistics in Scheduler.
+#ifndef INS_SCHEDULER_STATISTICS
+#define INS_SCHEDULER_STATISTICS 0
+#endif
+
+// Set to 1 to sample polled inputs by reading whole GPIO port input registers instead of digitalRead().
+// Each port is read once per poll and all polled inputs share one timestamp.
+#ifndef INS_PORT_SAMPLING
+#define INS_PORT_SAMPLING 0
+#endif
+
+// Max number of ports with polled inputs when INS_PORT_SAMPLING is enabled.
+#ifndef INS_MAX_INPUT_PORTS
+#define INS_MAX_INPUT_PORTS 4
+#endif
+
+// Max number of interrupt pins in all Scheduler instances together.
+#ifndef INS_MAX_PIN_INTERRUPTS
+#define INS_MAX_PIN_INTERRUPTS INS_SEQUENCER_MAX_NUM_INPUTS
 #endif
 
 #define INS_STR_(v) #v
@@ -71,19 +88,111 @@ void InsError(uint32_t error);
 namespace inseparates
 {
 
+#if INS_SCHEDULER_STATISTICS
+// Call count, execution time and lateness histogram collected by Scheduler.
+// All times are in microseconds.
+struct CallStatistics
+{
+	static const uint8_t kLatenessBuckets = 12;
+
+	uint32_t calls;
+	uint32_t totalMicros;
+	uint16_t maxMicros;
+	// Bucket 0 counts calls that were on time, bucket n calls that were [2^(n-1), 2^n) late
+	// and the last bucket everything later than that. Saturates at 0xFFFF.
+	uint16_t lateness[kLatenessBuckets];
+
+	CallStatistics() { reset(); }
+
+	void reset()
+	{
+		calls = 0;
+		totalMicros = 0;
+		maxMicros = 0;
+		for (uint8_t i = 0; i < kLatenessBuckets; ++i)
+		{
+			lateness[i] = 0;
+		}
+	}
+
+	uint16_t meanMicros() const { return calls ? totalMicros / calls : 0; }
+
+	void add(uint16_t micros, ins_smicros_t late)
+	{
+		++calls;
+		totalMicros += micros;
+		if (micros > maxMicros)
+			maxMicros = micros;
+		uint8_t bucket = 0;
+		for (; late > 0 && bucket < kLatenessBuckets - 1; late >>= 1)
+		{
+			++bucket;
+		}
+		if (lateness[bucket] != 0xFFFF)
+			++lateness[bucket];
+	}
+};
+#endif
+
 // Cooperative multitasking based on tasks that runs non-blocking code
 // and sleeps the returned microseconds after each step.
 
 class SteppedTask
 {
+	friend class Scheduler;
+
+	// Scheduler slot, only valid while active.
+	// A task can only be active in one Scheduler at a time.
+	uint8_t _schedulerSlot = (uint8_t)-1;
+
+	// Duration of the last longSleep(), counted down by Scheduler.
+	uint32_t _longSleepMicros = 0;
+
+#if INS_SCHEDULER_STATISTICS
+	CallStatistics _statistics;
+#endif
+
 public:
 	static const uint16_t kInvalidDelta = (uint16_t)-1;
+	static const uint16_t kLongSleep = (uint16_t)-2;
 	static const uint16_t kMaxSleepMicros = 0x7FFF;
+	// Longest time a Scheduler waits between task deadlines, longer sleeps are split.
+	static const ins_micros_t kMaxDeadlineMicros = INS_SHORT_MICROS ? 0x7FFF : 0x3FFFFFFF;
 
 	// Must be non-blocking.
 	// Returns number of microseconds to wait until next call.
 	// Returning kInvalidDelta stops the task.
+	// Return longSleep() to sleep longer than kMaxSleepMicros.
 	virtual uint16_t SteppedTask_step() = 0;
+
+	// Microseconds to wait for a SteppedTask_step() return value other than kInvalidDelta.
+	uint32_t sleepMicros(uint16_t delta) const { return delta == kLongSleep ? _longSleepMicros : delta; }
+
+protected:
+	// Returns kLongSleep if micros does not fit in the return value of SteppedTask_step().
+	uint16_t longSleep(uint32_t micros)
+	{
+		if (micros <= kMaxSleepMicros)
+			return micros;
+		_longSleepMicros = micros;
+		return kLongSleep;
+	}
+
+private:
+	ins_micros_t sleepChunk()
+	{
+		ins_micros_t chunk = _longSleepMicros > kMaxDeadlineMicros ? kMaxDeadlineMicros : _longSleepMicros;
+		_longSleepMicros -= chunk;
+		return chunk;
+	}
+
+public:
+
+#if INS_SCHEDULER_STATISTICS
+	// SteppedTask_step() calls from Scheduler::poll().
+	// Lateness is measured against the requested step time.
+	CallStatistics &statistics() { return _statistics; }
+#endif
 };
 
 class DummyTask : public SteppedTask
@@ -94,6 +203,12 @@ public:
 
 class Decoder
 {
+	friend class Scheduler;
+
+#if INS_SCHEDULER_STATISTICS
+	CallStatistics _statistics;
+#endif
+
 public:
 	static const uint16_t kInvalidTimeout = (uint16_t)0;
 	static const uint16_t kMaxTimeout = 0x7FFF;
@@ -105,81 +220,246 @@ public:
 
 	// This is called when no input transition has happend during the returned timeout.
 	virtual void Decoder_timeout(uint8_t pinState) = 0;
+
+	// Several transitions at once, used for pins in batch mode, see Scheduler::batch().
+	// firstState is the state before the first transition, the state toggles for each pulse.
+	// Should return the timeout after the last pulse.
+	// Override this when the pulses can be handled faster together.
+	virtual uint16_t Decoder_pulses(uint8_t firstState, const uint16_t *pulseWidths, uint8_t count)
+	{
+		uint16_t timeout = kInvalidTimeout;
+		for (uint8_t i = 0; i < count; ++i, firstState ^= 1)
+		{
+			timeout = Decoder_pulse(firstState, pulseWidths[i]);
+		}
+		return timeout;
+	}
+
+	// This is called when input transitions were lost, e.g. due to input FIFO overflow.
+	// Any partially received data should be dropped.
+	// The next Decoder_pulse() will have zero pulseWidth, as after a timeout.
+	virtual void Decoder_resync() {}
+
+#if INS_SCHEDULER_STATISTICS
+	// Decoder_pulse() and Decoder_timeout() calls.
+	// Lateness is measured from the edge or timeout to the call.
+	CallStatistics &statistics() { return _statistics; }
+#endif
 };
 
+// Fixed capacity binary min-heap of slot indices ordered by deadline.
+// Deadlines are compared with wraparound and must all be within half the ins_micros_t range from each other.
+template<uint8_t N>
+class DeadlineQueue
+{
+public:
+	static const uint8_t kNotQueued = (uint8_t)-1;
+
+private:
+	ins_micros_t _deadline[N];
+	uint8_t _heap[N];
+	uint8_t _position[N];
+	uint8_t _size = 0;
+
+public:
+	DeadlineQueue()
+	{
+		for (uint8_t i = 0; i < N; ++i)
+		{
+			_position[i] = kNotQueued;
+		}
+	}
+
+	bool empty() const { return !_size; }
+	uint8_t size() const { return _size; }
+	bool queued(uint8_t slot) const { return _position[slot] != kNotQueued; }
+	ins_micros_t deadline(uint8_t slot) const { return _deadline[slot]; }
+
+	// Slot with the earliest deadline, the queue must not be empty.
+	uint8_t top() const { return _heap[0]; }
+
+	// True if the earliest deadline is now or has passed.
+	bool due(ins_micros_t now) const { return _size && ins_smicros_t(_deadline[_heap[0]] - now) <= 0; }
+
+	// True if the earliest deadline has passed.
+	bool expired(ins_micros_t now) const { return _size && ins_smicros_t(_deadline[_heap[0]] - now) < 0; }
+
+	// Insert slot or move it if already queued.
+	void set(uint8_t slot, ins_micros_t deadline)
+	{
+		_deadline[slot] = deadline;
+		uint8_t pos = _position[slot];
+		if (pos == kNotQueued)
+		{
+			pos = _size++;
+			_heap[pos] = slot;
+			_position[slot] = pos;
+			siftUp(pos);
+			return;
+		}
+		if (!siftUp(pos))
+			siftDown(pos);
+	}
+
+	void remove(uint8_t slot)
+	{
+		uint8_t pos = _position[slot];
+		if (pos == kNotQueued)
+			return;
+		_position[slot] = kNotQueued;
+		--_size;
+		if (pos == _size)
+			return;
+		uint8_t last = _heap[_size];
+		_heap[pos] = last;
+		_position[last] = pos;
+		if (!siftUp(pos))
+			siftDown(pos);
+	}
+
+private:
+	bool before(uint8_t a, uint8_t b) const { return ins_smicros_t(_deadline[a] - _deadline[b]) < 0; }
+
+	void swap(uint8_t posA, uint8_t posB)
+	{
+		uint8_t a = _heap[posA];
+		uint8_t b = _heap[posB];
+		_heap[posA] = b;
+		_heap[posB] = a;
+		_position[a] = posB;
+		_position[b] = posA;
+	}
+
+	bool siftUp(uint8_t pos)
+	{
+		bool moved = false;
+		while (pos)
+		{
+			uint8_t parent = (pos - 1) >> 1;
+			if (!before(_heap[pos], _heap[parent]))
+				break;
+			swap(pos, parent);
+			pos = parent;
+			moved = true;
+		}
+		return moved;
+	}
+
+	void siftDown(uint8_t pos)
+	{
+		for (;;)
+		{
+			uint8_t child = (pos << 1) + 1;
+			if (child >= _size)
+				return;
+			if (child + 1 < _size && before(_heap[child + 1], _heap[child]))
+				++child;
+			if (!before(_heap[child], _heap[pos]))
+				return;
+			swap(pos, child);
+			pos = child;
+		}
+	}
+};
+
+// Smallest index type that can hold [0, N).
+template<bool Small>
+struct LockFreeFIFOIndex { typedef uint8_t type; };
+template<>
+struct LockFreeFIFOIndex<false> { typedef uint16_t type; };
+
+// Single producer single consumer FIFO.
+// N must be a power of two and the capacity is N - 1.
+// The batch functions take an offset from the current read or write position.
 #ifdef AVR
 template<typename T, size_t N>
 class LockFreeFIFO {
+	static_assert(N >= 2 && (N & (N - 1)) == 0, "LockFreeFIFO length must be a power of two");
+	static_assert(N <= 256, "LockFreeFIFO index must be 8-bit to be atomic on AVR");
+public:
+	typedef uint8_t index_t;
 private:
+	static const index_t kMask = N - 1;
 	T _data[N];
-	volatile uint8_t _writePos = 0;
-	volatile uint8_t _readPos = 0;
+	volatile index_t _writePos = 0;
+	volatile index_t _readPos = 0;
 public:
-	bool full() const { return (_writePos + 1) % N == _readPos; }
+	bool full() const { return ((_writePos + 1) & kMask) == _readPos; }
+	index_t freeSpace() const { return (_readPos - _writePos - 1) & kMask; }
 	T& writeRef() { return _data[_writePos]; }
-	void push() { _writePos = (_writePos + 1) % N; }
+	T& writeRef(index_t offset) { return _data[(_writePos + offset) & kMask]; }
+	void push() { _writePos = (_writePos + 1) & kMask; }
+	void push(index_t count) { _writePos = (_writePos + count) & kMask; }
 
 	bool empty() const { return _readPos == _writePos; }
+	index_t size() const { return (_writePos - _readPos) & kMask; }
 	const T& readRef() const { return _data[_readPos]; }
-	void pop() { _readPos = (_readPos + 1) % N; }
+	const T& readRef(index_t offset) const { return _data[(_readPos + offset) & kMask]; }
+	void pop() { _readPos = (_readPos + 1) & kMask; }
+	void pop(index_t count) { _readPos = (_readPos + count) & kMask; }
 };
 #else
 template<typename T, size_t N>
 class LockFreeFIFO {
+	static_assert(N >= 2 && (N & (N - 1)) == 0, "LockFreeFIFO length must be a power of two");
+	static_assert(N <= 0x10000, "LockFreeFIFO too long");
+public:
+	typedef typename LockFreeFIFOIndex<N <= 0x100>::type index_t;
 private:
+	static const index_t kMask = N - 1;
 	T data[N];
-	std::atomic<uint8_t> _writePos = {0};
-	std::atomic<uint8_t> _readPos = {0};
+	std::atomic<index_t> _writePos = {0};
+	std::atomic<index_t> _readPos = {0};
 public:
 	INS_IRAM_ATTR bool full() const
 	{
-		uint8_t currentWritePos = _writePos.load(std::memory_order_relaxed);
-		uint8_t nextWritePos = (currentWritePos + 1) % N;
-		uint8_t currenReadPos = _readPos.load(std::memory_order_acquire);
-		return nextWritePos == currenReadPos;
+		return freeSpace() == 0;
+	}
+	// Number of entries that can be written before push(count).
+	INS_IRAM_ATTR index_t freeSpace() const
+	{
+		index_t currentWritePos = _writePos.load(std::memory_order_relaxed);
+		index_t currentReadPos = _readPos.load(std::memory_order_acquire);
+		return (currentReadPos - currentWritePos - 1) & kMask;
 	}
-	INS_IRAM_ATTR T& writeRef()
+	INS_IRAM_ATTR T& writeRef(index_t offset = 0)
 	{
-		uint8_t currentWritePos = _writePos.load(std::memory_order_relaxed);
-		return data[currentWritePos];
+		index_t currentWritePos = _writePos.load(std::memory_order_relaxed);
+		return data[(currentWritePos + offset) & kMask];
 	}
-	INS_IRAM_ATTR void push()
+	INS_IRAM_ATTR void push(index_t count = 1)
 	{
-		uint8_t currentWritePos = _writePos.load(std::memory_order_relaxed);
-		uint8_t nextWritePos = (currentWritePos + 1) % N;
+		index_t currentWritePos = _writePos.load(std::memory_order_relaxed);
+		index_t nextWritePos = (currentWritePos + count) & kMask;
 		_writePos.store(nextWritePos, std::memory_order_release);
 	}
 	INS_IRAM_ATTR bool empty() const
 	{
 		return _readPos.load(std::memory_order_relaxed) == _writePos.load(std::memory_order_acquire);
 	}
-	INS_IRAM_ATTR const T& readRef() const
+	// Number of entries that can be read before pop(count).
+	INS_IRAM_ATTR index_t size() const
 	{
-		uint8_t currentReadPos = _readPos.load(std::memory_order_relaxed);
-		return data[currentReadPos];
+		index_t currentReadPos = _readPos.load(std::memory_order_relaxed);
+		index_t currentWritePos = _writePos.load(std::memory_order_acquire);
+		return (currentWritePos - currentReadPos) & kMask;
 	}
-	INS_IRAM_ATTR void pop()
+	INS_IRAM_ATTR const T& readRef(index_t offset = 0) const
 	{
-		uint8_t currentReadPos = _readPos.load(std::memory_order_relaxed);
-		uint8_t nextReadPos = (currentReadPos + 1) % N;
+		index_t currentReadPos = _readPos.load(std::memory_order_relaxed);
+		return data[(currentReadPos + offset) & kMask];
+	}
+	INS_IRAM_ATTR void pop(index_t count = 1)
+	{
+		index_t currentReadPos = _readPos.load(std::memory_order_relaxed);
+		index_t nextReadPos = (currentReadPos + count) & kMask;
 		_readPos.store(nextReadPos, std::memory_order_release);
 	}
 };
 #endif
 
-extern "C"
-{
-INS_IRAM_ATTR void pinISR0();
-INS_IRAM_ATTR void pinISR1();
-INS_IRAM_ATTR void pinISR2();
-#ifndef AVR
-INS_IRAM_ATTR void pinISR3();
-INS_IRAM_ATTR void pinISR4();
-INS_IRAM_ATTR void pinISR5();
-INS_IRAM_ATTR void pinISR6();
-INS_IRAM_ATTR void pinISR7();
-#endif
-}
+template <uint8_t P>
+struct PinISR;
 
 // Input polling and task scheduling
 class Scheduler
@@ -194,98 +474,13 @@ public:
 	struct InputData
 	{
 		ins_micros_t micros;
-		uint8_t pin;
+		uint8_t pinIndex; // Scheduler input index, not Arduino pin number.
 		uint8_t state;
 	};
 
-#ifdef AVR
-#define MAX_PIN_CALLBACKS 3
-#else
-#define MAX_PIN_CALLBACKS 8
-#endif
-	class PinStatePusher
-	{
-		Scheduler *_scheduler;
-		uint8_t _pin;
-	public:
-#if !(UNIT_TEST || USE_FUNCTIONAL_INTERRUPT)
-		static uint8_t s_pinUsage[MAX_PIN_CALLBACKS];
-#endif
-		PinStatePusher(Scheduler *scheduler, uint8_t pin) : _scheduler(scheduler), _pin(pin)
-		{
-#if UNIT_TEST || USE_FUNCTIONAL_INTERRUPT
-			attachInterrupt(digitalPinToInterrupt(_pin), std::bind(&PinStatePusher::pinISR, this), CHANGE);
-#else
-			schedulerInstance(_scheduler);
-
-			uint8_t i = 0;
-			for (; i < MAX_PIN_CALLBACKS; ++i)
-			{
-				if (s_pinUsage[i] == (uint8_t)-1)
-				{
-					s_pinUsage[i] = _pin;
-					void (*isr)();
-					switch (i)
-					{
-					case 0: isr = pinISR0; break;
-					case 1: isr = pinISR1; break;
-					case 2: isr = pinISR2; break;
-#ifndef AVR
-					case 3: isr = pinISR3; break;
-					case 4: isr = pinISR4; break;
-					case 5: isr = pinISR5; break;
-					case 6: isr = pinISR6; break;
-					case 7: isr = pinISR7; break;
-#endif
-					default: InsError(*(uint32_t*)"icnt");
-					}
-					attachInterrupt(digitalPinToInterrupt(_pin), isr, CHANGE);
-					break;
-				}
-			}
-			if (i == MAX_PIN_CALLBACKS)
-				InsError(*(uint32_t*)"insp");
-#endif
-		}
-		~PinStatePusher()
-		{
-			detachInterrupt(digitalPinToInterrupt(_pin));
-#if !(UNIT_TEST || USE_FUNCTIONAL_INTERRUPT)
-			for (uint8_t i = 0; i < MAX_PIN_CALLBACKS; ++i)
-			{
-				if (s_pinUsage[i] == _pin)
-				{
-					s_pinUsage[i] = (uint8_t)-1;
-					break;
-				}
-			}
-#endif
-		}
-
-		uint8_t pin() { return _pin; }
-
-#if UNIT_TEST || USE_FUNCTIONAL_INTERRUPT
-		/*INS_IRAM_ATTR*/ void pinISR()
-		{
-			auto &inputFifo = _scheduler->_inputFIFO;
-			auto &w = inputFifo.writeRef();
-			w.micros = fastMicros();
-			w.pin = _pin;
-			w.state = digitalRead(_pin);
-			inputFifo.push();
-		}
-#endif
-		INS_IRAM_ATTR static Scheduler *schedulerInstance(Scheduler *inst = nullptr)
-		{
-			static Scheduler *s_instance;
-			if (inst)
-				s_instance = inst;
-			return s_instance;
-		}
-	};
-
 private:
-	friend class PinStatePusher;
+	template <uint8_t P>
+	friend struct PinISR;
 
 #if INS_SEQUENCER_MAX_NUM_TASKS <= 8
 	typedef uint8_t task_flags_t;
@@ -298,41 +493,64 @@ private:
 #else
 	Too many tasks
 #endif
-#if INS_SEQUENCER_MAX_DECODERS <= 8
+#if INS_SEQUENCER_MAX_NUM_INPUTS <= 8
 	typedef uint8_t pin_flags_t;
-#elif INS_SEQUENCER_MAX_DECODERS <= 16
+#elif INS_SEQUENCER_MAX_NUM_INPUTS <= 16
 	typedef uint16_t pin_flags_t;
-#elif INS_SEQUENCER_MAX_DECODERS <= 32
+#elif INS_SEQUENCER_MAX_NUM_INPUTS <= 32
 	typedef uint32_t pin_flags_t;
-#elif INS_SEQUENCER_MAX_DECODERS <= 64
+#elif INS_SEQUENCER_MAX_NUM_INPUTS <= 64
 	typedef uint64_t pin_flags_t;
 #else
 	Too many inputs
 #endif
-#if INS_SEQUENCER_MAX_NUM_INPUTS <= 8
+#if INS_SEQUENCER_MAX_DECODERS <= 8
 	typedef uint8_t pin_usage_t;
-#elif INS_SEQUENCER_MAX_NUM_INPUTS <= 16
+#elif INS_SEQUENCER_MAX_DECODERS <= 16
 	typedef uint16_t pin_usage_t;
-#elif INS_SEQUENCER_MAX_NUM_INPUTS <= 32
+#elif INS_SEQUENCER_MAX_DECODERS <= 32
 	typedef uint32_t pin_usage_t;
-#elif INS_SEQUENCER_MAX_NUM_INPUTS <= 64
+#elif INS_SEQUENCER_MAX_DECODERS <= 64
 	typedef uint64_t pin_usage_t;
 #else
 	Too many decoders
 #endif
 
 	LockFreeFIFO<InputData, INS_INPUT_FIFO_LENGTH> _inputFIFO;
+	// Set in InputData::state on the first edge after edges were dropped.
+	static const uint8_t kInputResync = 0x80;
+	// Written from the pin interrupts.
+	volatile uint16_t _pins_droppedEdges[INS_SEQUENCER_MAX_NUM_INPUTS];
+	volatile uint8_t _pins_resync[INS_SEQUENCER_MAX_NUM_INPUTS];
+	// Pin interrupt slot of interrupt pins.
+	uint8_t _pins_interruptSlot[INS_SEQUENCER_MAX_NUM_INPUTS];
+	uint16_t _inputFIFOMaxUsage = 0;
+#if INS_SCHEDULER_STATISTICS
+	CallStatistics _pollStatistics;
+	ins_micros_t _lastPollMicros;
+#endif
+#ifdef ESP32
+	// Notified from the pin interrupts while the startTask() task waits.
+	TaskHandle_t volatile _waitingTask = nullptr;
+#endif
+
+	static const uint8_t kNoSlot = (uint8_t)-1;
 
 	SteppedTask *_tasks_task[INS_SEQUENCER_MAX_NUM_TASKS] = { 0 };
 	Delegate *_tasks_delegate[INS_SEQUENCER_MAX_NUM_TASKS];
-	ins_micros_t _tasks_targetTime[INS_SEQUENCER_MAX_NUM_TASKS];
+	// Holds the target time of all active tasks so that only due tasks are touched.
+	DeadlineQueue<INS_SEQUENCER_MAX_NUM_TASKS> _tasks_queue;
 	task_flags_t _taskIsAbsolute = 0;
-	uint8_t _maxTask = 0;
+	// Stack of free task slots.
+	uint8_t _tasks_free[INS_SEQUENCER_MAX_NUM_TASKS];
+	uint8_t _numFreeTasks = 0;
 
 	Decoder *_decoders[INS_SEQUENCER_MAX_DECODERS] = { 0 };
 	ins_micros_t _decoders_lastTransitionMicros[INS_SEQUENCER_MAX_DECODERS];
-	ins_micros_t _decoders_nextTimeoutMicros[INS_SEQUENCER_MAX_DECODERS];
+	// Only decoders with an armed timeout are queued.
+	DeadlineQueue<INS_SEQUENCER_MAX_DECODERS> _decoders_timeouts;
 	uint8_t _decoders_pinState[INS_SEQUENCER_MAX_DECODERS];
+	uint8_t _decoders_pinIndex[INS_SEQUENCER_MAX_DECODERS];
 	uint8_t _maxDecoder = 0;
 
 	// This is used both for polled and interrupt driven pins.
@@ -342,33 +560,222 @@ private:
 	// Since there can be multiple decoders using a single pin this is a bit matrix where for each pin the bits corresponds to the decoder index
 	pin_usage_t _pins_usage[INS_SEQUENCER_MAX_NUM_INPUTS] = { 0 };
 	pin_flags_t _pins_isInterrupt = 0;
+	// Pins where frames are classified, see classify().
+	pin_flags_t _pins_classify = 0;
+	// Interrupt pins where queued edges are passed on together, see batch().
+	pin_flags_t _pins_batch = 0;
+	// Decoders that receive all edges until they finish their frame, zero when not locked.
+	pin_usage_t _pins_locked[INS_SEQUENCER_MAX_NUM_INPUTS] = { 0 };
+	// Decoders that missed edges while locked.
+	pin_usage_t _pins_skipped[INS_SEQUENCER_MAX_NUM_INPUTS] = { 0 };
+	// Per pin glitch filter, see add().
+	uint16_t _pins_minPulse[INS_SEQUENCER_MAX_NUM_INPUTS];
+	// Last state passed on to the decoders by the filter.
+	uint8_t _pins_filteredState[INS_SEQUENCER_MAX_NUM_INPUTS];
+	// Time of an edge that has not yet lasted minPulse.
+	ins_micros_t _pins_pendingMicros[INS_SEQUENCER_MAX_NUM_INPUTS];
+	pin_flags_t _pins_pending = 0;
 	uint8_t _maxPolledPin = 0;
 	uint8_t _maxInterruptPin = 0;
 
+#if INS_PORT_SAMPLING
+#ifdef AVR
+	typedef uint8_t port_t;
+#else
+	typedef uint32_t port_t;
+#endif
+	static const uint8_t kNoPort = (uint8_t)-1;
+	volatile port_t *_ports_register[INS_MAX_INPUT_PORTS];
+	// Bits of the polled inputs in each port, zero for unused ports.
+	port_t _ports_mask[INS_MAX_INPUT_PORTS] = { 0 };
+	port_t _ports_sample[INS_MAX_INPUT_PORTS];
+#if INS_ENABLE_INPUT_FILTER
+	// Bits of the polled inputs where the filter has not settled.
+	port_t _ports_unsettled[INS_MAX_INPUT_PORTS] = { 0 };
+#endif
+	uint8_t _pins_port[INS_SEQUENCER_MAX_NUM_INPUTS];
+	port_t _pins_bitMask[INS_SEQUENCER_MAX_NUM_INPUTS];
+#endif
+
 	static const uint8_t PIN_STATE_TIMEOUT = 0x2;
 	static const uint8_t PIN_STATE_REPORTED = 0x1;
 	inline bool timeoutPinState(uint8_t pinState) { return !!((pinState & PIN_STATE_TIMEOUT) >> 1); }
 	inline uint8_t reportedPinState(uint8_t pinState) { return (pinState & PIN_STATE_REPORTED); }
 
-#if AVR
-	PinStatePusher *_pinInterrupts[MAX_PIN_CALLBACKS] = { nullptr };
-#else
-	std::map<uint8_t, std::unique_ptr<PinStatePusher>> _pinInterrupts;
-#endif
+	// Owner and input index of a pin interrupt slot.
+	// Each slot has its own interrupt handler, see PinISR.
+	struct InterruptSlot
+	{
+		Scheduler *scheduler;
+		uint8_t pinIndex;
+	};
+
+	// Shared by all instances.
+	// Defined here and not in the library so that the size follows the sketch's INS_MAX_PIN_INTERRUPTS.
+	INS_IRAM_ATTR static InterruptSlot *interruptSlots()
+	{
+		static InterruptSlot s_interruptSlots[INS_MAX_PIN_INTERRUPTS];
+		return s_interruptSlots;
+	}
+
+	INS_IRAM_ATTR static void pinInterrupt(uint8_t slot)
+	{
+		const InterruptSlot &s = interruptSlots()[slot];
+		s.scheduler->pushInput(s.pinIndex, s.scheduler->_pins_pin[s.pinIndex]);
+	}
+	static void (*pinISR(uint8_t slot))();
+
+	bool reserveInterruptSlot(uint8_t p)
+	{
+		InterruptSlot *slots = interruptSlots();
+		for (uint8_t slot = 0; slot < INS_MAX_PIN_INTERRUPTS; ++slot)
+		{
+			if (slots[slot].scheduler)
+				continue;
+			slots[slot].scheduler = this;
+			slots[slot].pinIndex = p;
+			_pins_interruptSlot[p] = slot;
+			return true;
+		}
+		return false;
+	}
+
+	void detachPinInterrupt(uint8_t p)
+	{
+		detachInterrupt(digitalPinToInterrupt(_pins_pin[p]));
+		interruptSlots()[_pins_interruptSlot[p]].scheduler = nullptr;
+	}
 
 public:
 	Scheduler()
 	{
-#if !(UNIT_TEST || USE_FUNCTIONAL_INTERRUPT)
-		for (uint8_t i = 0; i < MAX_PIN_CALLBACKS; ++i)
+		for (uint8_t i = INS_SEQUENCER_MAX_NUM_TASKS; i; --i)
 		{
-			PinStatePusher::s_pinUsage[i] = (uint8_t)-1;
+			_tasks_free[_numFreeTasks++] = i - 1;
+		}
+	}
+
+	~Scheduler()
+	{
+		pin_flags_t pinIndexMask = 1ULL;
+		for (uint8_t p = 0; p < INS_SEQUENCER_MAX_NUM_INPUTS; ++p, pinIndexMask <<= 1)
+		{
+			if (_pins_isInterrupt & pinIndexMask)
+				detachPinInterrupt(p);
 		}
-#endif
 	}
 
 	INS_IRAM_ATTR LockFreeFIFO<InputData, INS_INPUT_FIFO_LENGTH> &inputFIFO() { return _inputFIFO; };
 
+	// Called from the pin interrupts.
+	INS_IRAM_ATTR void pushInput(uint8_t pinIndex, uint8_t pin)
+	{
+		if (_inputFIFO.full())
+		{
+			if (_pins_droppedEdges[pinIndex] != 0xFFFF)
+				_pins_droppedEdges[pinIndex] = _pins_droppedEdges[pinIndex] + 1;
+			_pins_resync[pinIndex] = 1;
+			return;
+		}
+		auto &w = _inputFIFO.writeRef();
+		w.micros = fastMicros();
+		w.pinIndex = pinIndex;
+		w.state = digitalRead(pin);
+		if (_pins_resync[pinIndex])
+		{
+			w.state |= kInputResync;
+			_pins_resync[pinIndex] = 0;
+		}
+		_inputFIFO.push();
+#ifdef ESP32
+		if (_waitingTask)
+		{
+			BaseType_t woken = pdFALSE;
+			vTaskNotifyGiveFromISR(_waitingTask, &woken);
+			if (woken)
+				portYIELD_FROM_ISR();
+		}
+#endif
+	}
+
+	// Number of edges on an interrupt pin that were dropped because the input FIFO was full.
+	// Saturates at 0xFFFF.
+	uint16_t droppedEdges(uint8_t pin)
+	{
+		uint8_t p = pinIndex(pin, true);
+		if (p >= INS_SEQUENCER_MAX_NUM_INPUTS)
+			return 0;
+		return _pins_droppedEdges[p];
+	}
+
+	// Classify frames on a pin shared by several decoders.
+	// Edges go to all decoders on the pin until one or more of them return a timeout,
+	// usually after the leader pulse, and then only to those until they all return kInvalidTimeout or time out.
+	// The other decoders then see the next edge as after a timeout.
+	// This makes the work per edge about one Decoder_pulse() call instead of one per decoder,
+	// but a frame that starts during another frame is only seen by the decoders receiving that frame.
+	bool classify(uint8_t pin, bool enable = true)
+	{
+		uint8_t p = pinIndex(pin, true);
+		if (p >= INS_SEQUENCER_MAX_NUM_INPUTS)
+			return false;
+		pin_flags_t pinIndexMask = pin_flags_t(1) << p;
+		if (enable)
+		{
+			_pins_classify |= pinIndexMask;
+			return true;
+		}
+		_pins_classify &= ~pinIndexMask;
+		pin_usage_t locked = _pins_locked[p];
+		for (uint8_t i = 0; locked; ++i, locked >>= 1)
+		{
+			if (!(locked & 1))
+				continue;
+			unlockPin(p, reportedPinState(_decoders_pinState[i]));
+			break;
+		}
+		return true;
+	}
+
+	// Pass the queued edges of an interrupt pin to its decoder in one Decoder_pulses() call
+	// instead of one Decoder_pulse() call per edge.
+	// This cuts the call overhead at high edge rates, e.g. for a soft UART at high baud rates.
+	// Only used while the pin has a single decoder and no minPulse filter.
+	bool batch(uint8_t pin, bool enable = true)
+	{
+		uint8_t p = pinIndex(pin, true);
+		if (p >= INS_SEQUENCER_MAX_NUM_INPUTS)
+			return false;
+		pin_flags_t pinIndexMask = pin_flags_t(1) << p;
+		if (enable)
+			_pins_batch |= pinIndexMask;
+		else
+			_pins_batch &= ~pinIndexMask;
+		return true;
+	}
+
+	// Highest number of input FIFO entries seen by a poll.
+	// Use this to size INS_INPUT_FIFO_LENGTH.
+	uint16_t inputFIFOMaxUsage() const { return _inputFIFOMaxUsage; }
+
+#if INS_SCHEDULER_STATISTICS
+	// Execution time of poll(). The lateness histogram holds the time between polls.
+	const CallStatistics &pollStatistics() const { return _pollStatistics; }
+#endif
+
+	// Does not reset task and decoder statistics.
+	void resetStatistics()
+	{
+		for (uint8_t p = 0; p < INS_SEQUENCER_MAX_NUM_INPUTS; ++p)
+		{
+			_pins_droppedEdges[p] = 0;
+		}
+		_inputFIFOMaxUsage = 0;
+#if INS_SCHEDULER_STATISTICS
+		_pollStatistics.reset();
+#endif
+	}
+
 	void begin()
 	{
 #if INS_FAST_COUNT
@@ -379,89 +786,52 @@ public:
 	// Add and step task.
 	bool add(SteppedTask *task, Delegate *delegate = nullptr, bool absolute = true)
 	{
-		for (uint8_t i = 0; i < INS_SEQUENCER_MAX_NUM_TASKS; ++i)
-		{
-			if (_tasks_task[i])
-				continue;
-			_tasks_task[i] = task;
-			_tasks_delegate[i] = delegate;
-			_tasks_targetTime[i] = fastMicros();
-			_tasks_targetTime[i] += task->SteppedTask_step();
-			task_flags_t bitMask = 1ULL << i;
-			_taskIsAbsolute &= ~bitMask;
-			if (absolute)
-				_taskIsAbsolute |= bitMask;
-			if (i + 1 > _maxTask)
-				_maxTask = i + 1;
-			return true;
-		}
-		InsError(*(uint32_t*)"tovf");
-		return false;
+		uint8_t i = allocateTask(task, delegate, absolute);
+		if (i == kNoSlot)
+			return false;
+		ins_micros_t now = fastMicros();
+		uint16_t delta = task->SteppedTask_step();
+		if (_tasks_task[i] == task && !_tasks_queue.queued(i))
+			_tasks_queue.set(i, now + taskDelay(task, delta));
+		return true;
 	}
 
 	// Add task after microseconds.
-	bool addDelayed(SteppedTask *task, ins_micros_t delayUS, Delegate *delegate = nullptr, bool absolute = true)
+	bool addDelayed(SteppedTask *task, uint32_t delayUS, Delegate *delegate = nullptr, bool absolute = true)
 	{
-		for (uint8_t i = 0; i < INS_SEQUENCER_MAX_NUM_TASKS; ++i)
-		{
-			if (_tasks_task[i])
-				continue;
-			_tasks_task[i] = task;
-			_tasks_delegate[i] = delegate;
-			_tasks_targetTime[i] = fastMicros();
-			_tasks_targetTime[i] += delayUS;
-			task_flags_t bitMask = 1ULL << i;
-			_taskIsAbsolute &= ~bitMask;
-			if (absolute)
-				_taskIsAbsolute |= bitMask;
-			if (i + 1 > _maxTask)
-				_maxTask = i + 1;
-			return true;
-		}
-		InsError(*(uint32_t*)"tovf");
-		return false;
+		uint8_t i = allocateTask(task, delegate, absolute);
+		if (i == kNoSlot)
+			return false;
+		task->_longSleepMicros = delayUS;
+		_tasks_queue.set(i, fastMicros() + task->sleepChunk());
+		return true;
 	}
 
 	// Remove task.
 	bool remove(SteppedTask *task)
 	{
-		bool found = false;
-		for (uint8_t i = 0; i < _maxTask; ++i)
-		{
-			if (_tasks_task[i] != task)
-				continue;
-			_tasks_task[i] = nullptr;
-			found = true;
-			break;
-		}
-		if (!found)
+		uint8_t i = taskSlot(task);
+		if (i == kNoSlot)
 		{
 			InsError(*(uint32_t*)"nstk");
 			return false;
 		}
-		for (uint8_t i = _maxTask; i; --i)
-		{
-			if (_tasks_task[i - 1])
-				return true;
-			_maxTask = i;
-		}
+		_tasks_queue.remove(i);
+		freeTask(i);
 		return true;
 	}
 
 	// Check if task is active.
 	bool active(SteppedTask *task)
 	{
-		for (uint8_t i = 0; i < _maxTask; ++i)
-		{
-			if (_tasks_task[i] != task)
-				continue;
-			return true;
-		}
-		return false;
+		return taskSlot(task) != kNoSlot;
 	}
 
 	// Add Decoder.
-	bool add(Decoder *decoder, uint8_t pin, bool interrupt = false)
+	// Pulses shorter than minPulseMicros on the pin are removed together with the edge that started them.
+	// Edges are then passed on with their original time once they have lasted minPulseMicros.
+	// The longest minPulseMicros of the decoders sharing a pin is used.
+	bool add(Decoder *decoder, uint8_t pin, bool interrupt = false, uint16_t minPulseMicros = 0)
 	{
 #ifdef AVR
 		// TODO: make this correct for other versions than 328P
@@ -472,7 +842,7 @@ public:
 		if (pin == 16)
 			interrupt = false;
 #endif
-		for (uint8_t i = 0; i < INS_SEQUENCER_MAX_NUM_INPUTS; ++i)
+		for (uint8_t i = 0; i < INS_SEQUENCER_MAX_DECODERS; ++i)
 		{
 			if (_decoders[i] == decoder)
 			{
@@ -482,9 +852,7 @@ public:
 			if (_decoders[i])
 				continue;
 			_decoders[i] = decoder;
-			ins_micros_t now = fastMicros();
-			_decoders_lastTransitionMicros[i] = now;
-			_decoders_nextTimeoutMicros[i] = now;
+			_decoders_lastTransitionMicros[i] = fastMicros();
 			if (i + 1 > _maxDecoder)
 				_maxDecoder = i + 1;
 
@@ -493,10 +861,23 @@ public:
 			if (newPin)
 			{
 				_pins_pin[p] = pin;
+				_pins_droppedEdges[p] = 0;
+				_pins_resync[p] = 0;
+				if (interrupt && !reserveInterruptSlot(p))
+				{
+					// Poll instead.
+					InsError(*(uint32_t*)"isrs");
+					interrupt = false;
+				}
 #if INS_ENABLE_INPUT_FILTER
 				_pins_pinState[p] = 3 * digitalRead(pin);
 #else
 				_pins_pinState[p] = digitalRead(pin);
+#endif
+#if INS_PORT_SAMPLING
+				_pins_port[p] = kNoPort;
+				if (!interrupt)
+					addPortInput(p, pin);
 #endif
 			}
 #if INS_ENABLE_INPUT_FILTER
@@ -504,7 +885,17 @@ public:
 #else
 			_decoders_pinState[i] = !!_pins_pinState[p];
 #endif
+			if (newPin || minPulseMicros > _pins_minPulse[p])
+			{
+				if (newPin || !_pins_minPulse[p])
+				{
+					_pins_filteredState[p] = _decoders_pinState[i];
+					_pins_pending &= ~(pin_flags_t(1) << p);
+				}
+				_pins_minPulse[p] = minPulseMicros;
+			}
 			_pins_usage[p] |= 1ULL << i;
+			_decoders_pinIndex[i] = p;
 			if (interrupt)
 			{
 				if (i + 1 > _maxInterruptPin)
@@ -512,25 +903,8 @@ public:
 
 				pin_flags_t pinIndexMask = 1ULL << p;
 				_pins_isInterrupt |= pinIndexMask;
-				if (newPin)
-				{
-#ifdef UNIT_TEST
-					assert(!_pinInterrupts.count(pin));
-#endif
-#if AVR
-					for (uint8_t psp = 0; psp < MAX_PIN_CALLBACKS; ++psp)
-					{
-						if (_pinInterrupts[psp])
-						{
-							continue;
-						}
-						_pinInterrupts[psp] = new PinStatePusher(this, pin);
-						break;
-					}
-#else
-					_pinInterrupts[pin] = std::unique_ptr<PinStatePusher>(new PinStatePusher(this, pin));
-#endif
-				}
+				if (newPin)
+					attachInterrupt(digitalPinToInterrupt(pin), pinISR(_pins_interruptSlot[p]), CHANGE);
 			}
 			else
 			{
@@ -561,19 +935,7 @@ public:
 				if (!(_pins_usage[p] & decoderBitMask))
 					continue;
 				_pins_isInterrupt &= ~pinIndexMask;
-#if AVR
-				for (uint8_t psp = 0; psp < MAX_PIN_CALLBACKS; ++psp)
-				{
-					if (_pinInterrupts[psp] && _pinInterrupts[psp]->pin() == _pins_pin[p])
-					{
-						delete _pinInterrupts[psp];
-						_pinInterrupts[psp] = nullptr;
-						break;
-					}
-				}
-#else
-				_pinInterrupts.erase(_pins_pin[p]);
-#endif
+				detachPinInterrupt(p);
 				break;
 			}
 			break;
@@ -584,6 +946,7 @@ public:
 			if (_decoders[i] != decoder)
 				continue;
 			_decoders[i] = nullptr;
+			_decoders_timeouts.remove(i);
 			break;
 		}
 		if (i == _maxDecoder)
@@ -598,6 +961,22 @@ public:
 			if (!(_pins_usage[p] & decoderBitMask))
 				continue;
 			_pins_usage[p] &= ~decoderBitMask;
+			_pins_skipped[p] &= ~decoderBitMask;
+			if (_pins_locked[p] & decoderBitMask)
+			{
+				_pins_locked[p] &= ~decoderBitMask;
+				if (!_pins_locked[p])
+					unlockPin(p, reportedPinState(_decoders_pinState[i]));
+			}
+			if (!_pins_usage[p])
+			{
+				_pins_pending &= ~(pin_flags_t(1) << p);
+				_pins_batch &= ~(pin_flags_t(1) << p);
+			}
+#if INS_PORT_SAMPLING
+			if (!_pins_usage[p])
+				removePortInput(p);
+#endif
 			break;
 		}
 		for (uint8_t i = _maxDecoder; i; --i)
@@ -638,11 +1017,108 @@ public:
 	// Iterate all active tasks.
 	void poll()
 	{
+#if INS_SCHEDULER_STATISTICS
+		ins_micros_t start = fastMicros();
+		ins_micros_t sinceLast = _pollStatistics.calls ? start - _lastPollMicros : 0;
+		_lastPollMicros = start;
+#endif
 		pollInputs();
 		pollTasks();
 		pollInputFIFOs();
-		pollTimeouts();
+		// Timeouts after a held edge must wait for it.
+		pollTimeouts(pollFilters(fastMicros()));
+#if INS_SCHEDULER_STATISTICS
+		_pollStatistics.add(fastMicros() - start, sinceLast);
+#endif
+	}
+
+	// Earliest time when poll() has something to do.
+	// This is now if there are polled inputs or queued input edges.
+	// Returns false if there are no tasks, armed decoder timeouts or polled inputs.
+	bool nextDeadline(ins_micros_t &deadline)
+	{
+		ins_micros_t now = fastMicros();
+		if (!_inputFIFO.empty())
+		{
+			deadline = now;
+			return true;
+		}
+		pin_flags_t pinIndexMask = 1ULL;
+		for (uint8_t p = 0; p < _maxPolledPin || p < _maxInterruptPin; ++p, pinIndexMask <<= 1)
+		{
+			if (_pins_usage[p] && !(_pins_isInterrupt & pinIndexMask))
+			{
+				deadline = now;
+				return true;
+			}
+		}
+		bool found = false;
+		if (!_tasks_queue.empty())
+		{
+			deadline = _tasks_queue.deadline(_tasks_queue.top());
+			found = true;
+		}
+		if (!_decoders_timeouts.empty())
+		{
+			// Timeouts are reported when the deadline has passed.
+			ins_micros_t timeout = _decoders_timeouts.deadline(_decoders_timeouts.top()) + 1;
+			if (!found || ins_smicros_t(timeout - deadline) < 0)
+				deadline = timeout;
+			found = true;
+		}
+		pin_flags_t pending = _pins_pending;
+		for (uint8_t p = 0; pending; ++p, pending >>= 1)
+		{
+			if (!(pending & 1))
+				continue;
+			ins_micros_t confirm = _pins_pendingMicros[p] + _pins_minPulse[p];
+			if (!found || ins_smicros_t(confirm - deadline) < 0)
+				deadline = confirm;
+			found = true;
+		}
+		return found;
+	}
+
+	// Sleep or yield until nextDeadline(), an input interrupt or at most maxMicros.
+	// May return earlier, call poll() after this.
+	// On ESP32 input interrupts and wake() only end the wait early in the startTask() task,
+	// other tasks sleep with vTaskDelay() and their task notifications are left alone.
+	// On AVR and SAMD this sleeps until any interrupt and therefore often returns early.
+	// Returns false if it returned at once, because the next deadline is too close to sleep.
+	bool waitUntilNextEvent(uint32_t maxMicros = SteppedTask::kMaxSleepMicros)
+	{
+		return wait(maxMicros, false);
+	}
+
+	// Wake the startTask() task from another thread or core.
+	// Not for use in interrupts.
+	void wake()
+	{
+#ifdef ESP32
+		TaskHandle_t task = _waitingTask;
+		if (task)
+			xTaskNotifyGive(task);
+#endif
+	}
+
+#ifdef ESP32
+	// Run poll() and waitUntilNextEvent() forever in a new FreeRTOS task pinned to core.
+	// To split decoding and transmission between the cores use one Scheduler with only decoders
+	// on one core and one with only tasks on the other and pass data between them with Channel.
+	// Tasks and decoders must only be added and removed from the task running their Scheduler.
+	// The task blocks for at least one tick per poll so that lower priority tasks and IDLE can run,
+	// which keeps the task watchdog fed. Tasks and timeouts due within a tick can therefore be up to
+	// one tick (1 ms at the default 1000 Hz) late, and the input FIFO must hold the edges of one tick.
+	// Use InterruptWriteScheduler for output timing that needs better than that.
+	// The task is defined here and not in the library so that it is built with the same INS_ settings as the sketch.
+	TaskHandle_t startTask(BaseType_t core, UBaseType_t priority = 18, uint32_t stackSize = 4096)
+	{
+		TaskHandle_t task = nullptr;
+		if (xTaskCreatePinnedToCore(schedulerTask, "scheduler", stackSize, this, priority, &task, core) != pdPASS)
+			InsError(*(uint32_t*)"task");
+		return task;
 	}
+#endif
 
 	// Simple blocking wrapper of step() that runs until finished.
 	static void run(SteppedTask *task);
@@ -652,6 +1128,51 @@ public:
 #endif
 
 private:
+	// Sleep until an interrupt or at most idleMicros.
+	// On ESP32 notify waits for the task notification instead of only sleeping,
+	// only the startTask() task does that.
+	// Returns false without sleeping if idleMicros is too short for the platform.
+	static bool idle(uint32_t idleMicros, bool notify = false);
+
+	bool wait(uint32_t maxMicros, bool notify)
+	{
+#ifdef ESP32
+		if (notify)
+			_waitingTask = xTaskGetCurrentTaskHandle();
+#endif
+		uint32_t idleMicros = maxMicros;
+		ins_micros_t deadline = 0;
+		if (nextDeadline(deadline))
+		{
+			ins_smicros_t left = deadline - fastMicros();
+			if (left <= 0)
+				idleMicros = 0;
+			else if (uint32_t(left) < idleMicros)
+				idleMicros = left;
+		}
+		bool slept = idleMicros && idle(idleMicros, notify);
+#ifdef ESP32
+		_waitingTask = nullptr;
+#endif
+		return slept;
+	}
+
+#ifdef ESP32
+	static void schedulerTask(void *parameter)
+	{
+		Scheduler *scheduler = (Scheduler *)parameter;
+		for (;;)
+		{
+			scheduler->poll();
+			if (!scheduler->wait(SteppedTask::kMaxSleepMicros, true))
+			{
+				// Never spin, IDLE on this core must run.
+				vTaskDelay(1);
+			}
+		}
+	}
+#endif
+
 	uint8_t pinIndex(uint8_t pin, bool findOnly = false)
 	{
 		uint8_t p = 0;
@@ -682,27 +1203,101 @@ private:
 		return p;
 	}
 
+#if INS_PORT_SAMPLING
+	void addPortInput(uint8_t p, uint8_t pin)
+	{
+		volatile port_t *reg = portInputRegister(digitalPinToPort(pin));
+		port_t bitMask = digitalPinToBitMask(pin);
+		uint8_t port = kNoPort;
+		for (uint8_t i = 0; i < INS_MAX_INPUT_PORTS; ++i)
+		{
+			if (_ports_mask[i] && _ports_register[i] == reg)
+			{
+				port = i;
+				break;
+			}
+			if (!_ports_mask[i] && port == kNoPort)
+				port = i;
+		}
+		if (port == kNoPort)
+		{
+			InsError(*(uint32_t*)"ptov");
+			return;
+		}
+		_ports_register[port] = reg;
+		_ports_mask[port] |= bitMask;
+		_ports_sample[port] = (_ports_sample[port] & ~bitMask) | (_pins_pinState[p] ? bitMask : 0);
+		_pins_port[p] = port;
+		_pins_bitMask[p] = bitMask;
+	}
+
+	void removePortInput(uint8_t p)
+	{
+		uint8_t port = _pins_port[p];
+		if (port == kNoPort)
+			return;
+		_ports_mask[port] &= ~_pins_bitMask[p];
+#if INS_ENABLE_INPUT_FILTER
+		_ports_unsettled[port] &= ~_pins_bitMask[p];
+#endif
+		_pins_port[p] = kNoPort;
+	}
+#endif
+
 	void pollInputs()
 	{
 		pin_flags_t pinIndexMask = 1ULL;
 		ins_micros_t now = fastMicros();
+#if INS_PORT_SAMPLING
+		// Read all ports first, then handle only the inputs with changed bits.
+		port_t pending[INS_MAX_INPUT_PORTS];
+		port_t anyPending = 0;
+		for (uint8_t i = 0; i < INS_MAX_INPUT_PORTS; ++i)
+		{
+			pending[i] = 0;
+			if (!_ports_mask[i])
+				continue;
+			port_t sample = *_ports_register[i];
+			pending[i] = (sample ^ _ports_sample[i]) & _ports_mask[i];
+#if INS_ENABLE_INPUT_FILTER
+			pending[i] |= _ports_unsettled[i];
+#endif
+			_ports_sample[i] = sample;
+			anyPending |= pending[i];
+		}
+		if (!anyPending)
+			return;
+#endif
 		for (uint8_t p = 0; p < _maxPolledPin || p < _maxInterruptPin; ++p, pinIndexMask <<= 1)
 		{
 			if (_pins_isInterrupt & pinIndexMask)
 				continue;
 			if (!_pins_usage[p])
 				continue;
+#if INS_PORT_SAMPLING
+			uint8_t port = _pins_port[p];
+			if (port >= INS_MAX_INPUT_PORTS || !(pending[port] & _pins_bitMask[p]))
+				continue;
+			uint8_t pinState = !!(_ports_sample[port] & _pins_bitMask[p]);
+#else
+			uint8_t pinState = digitalRead(_pins_pin[p]);
+#endif
 #if INS_ENABLE_INPUT_FILTER // Removes single glitches
 			bool oldPinState = _pins_pinState[p] > 1;
-			uint8_t pinState = digitalRead(_pins_pin[p]);
 			if (pinState && _pins_pinState[p] < 3)
 				 ++_pins_pinState[p];
 			else if (!pinState && _pins_pinState[p] > 0)
 				--_pins_pinState[p];
 			bool newPinState = _pins_pinState[p] > 1;
+#if INS_PORT_SAMPLING
+			if (_pins_pinState[p] == 0 || _pins_pinState[p] == 3)
+				_ports_unsettled[port] &= ~_pins_bitMask[p];
+			else
+				_ports_unsettled[port] |= _pins_bitMask[p];
+#endif
 #else
 			uint8_t oldPinState = _pins_pinState[p];
-			uint8_t newPinState = digitalRead(_pins_pin[p]);
+			uint8_t newPinState = pinState;
 			_pins_pinState[p] = newPinState;
 #endif
 			if (newPinState == oldPinState)
@@ -714,109 +1309,298 @@ private:
 			s_sampleToggle ^= 1;
 			digitalWrite(INS_SAMPLE_DEBUG_PIN, s_sampleToggle);
 #endif
-			pin_usage_t usageLeft = _pins_usage[p];
-			for (uint8_t i = 0; usageLeft && i < _maxDecoder; ++i)
+			filterEdge(p, newPinState, now);
+#if !INS_PORT_SAMPLING
+			now = fastMicros();
+#endif
+		}
+	}
+
+	void pollInputFIFOs()
+	{
+		// Drain everything that was queued when the poll started in one pass.
+		// Entries that arrive meanwhile are handled in the next poll.
+		auto count = _inputFIFO.size();
+		if (!count)
+			return;
+		if (count > _inputFIFOMaxUsage)
+			_inputFIFOMaxUsage = count;
+		for (decltype(count) j = 0; j < count; ++j)
+		{
+			const InputData &input = _inputFIFO.readRef(j);
+			uint8_t p = input.pinIndex;
+			// The pin may have been removed after the edge was queued.
+			if (!_pins_usage[p])
+				continue;
+			uint8_t newPinState = input.state;
+			if (newPinState & kInputResync)
 			{
-				pin_usage_t decoderBitMask = 1ULL << i;
-				if (!(usageLeft & decoderBitMask))
-					continue;
-				usageLeft &= ~decoderBitMask;
+				newPinState &= ~kInputResync;
+				resyncPin(p, newPinState);
+				// As for the decoders the next edge is always passed on.
+				_pins_pending &= ~(pin_flags_t(1) << p);
+				_pins_filteredState[p] = newPinState ^ 1;
+			}
+			_pins_pinState[p] = newPinState;
+			pin_usage_t usage = _pins_usage[p];
+			if ((_pins_batch & (pin_flags_t(1) << p)) && !(usage & (usage - 1)) && !_pins_minPulse[p])
+			{
+				j = pulsesPin(p, newPinState, j, count);
+				continue;
+			}
+			filterEdge(p, newPinState, input.micros);
+		}
+		_inputFIFO.pop(count);
+	}
 
-				if (newPinState == reportedPinState(_decoders_pinState[i]))
-				{
-					continue;
-				}
-				uint16_t timeToReport = now -_decoders_lastTransitionMicros[i];
-				if (timeoutPinState(_decoders_pinState[i]))
-				{
+	// Report FIFO entry j and the following entries for pin index p to its only decoder in one call.
+	// Stops at INS_BATCH_LENGTH pulses, an entry for another pin or an entry after dropped edges.
+	// Returns the index of the last entry used.
+	template<typename Index>
+	Index pulsesPin(uint8_t p, uint8_t newPinState, Index j, Index count)
+	{
+		uint8_t i = 0;
+		for (pin_usage_t usage = _pins_usage[p]; !(usage & 1); usage >>= 1)
+			++i;
+		uint16_t pulseWidths[INS_BATCH_LENGTH];
+		uint8_t pulses = 0;
+		uint8_t pinState = _decoders_pinState[i];
+		uint8_t firstState = reportedPinState(pinState);
+		ins_micros_t lastTransition = _decoders_lastTransitionMicros[i];
+		for (;;)
+		{
+			const InputData &input = _inputFIFO.readRef(j);
+			if (newPinState != reportedPinState(pinState))
+			{
+				uint16_t timeToReport = input.micros - lastTransition;
+				if (timeoutPinState(pinState))
 					timeToReport = 0;
-				}
 				else if (timeToReport == 0)
-				{
 					timeToReport = 1;
-				}
+				pulseWidths[pulses++] = timeToReport;
+				pinState = newPinState;
+				lastTransition = input.micros;
+			}
+			if (pulses == INS_BATCH_LENGTH || j + 1 >= count)
+				break;
+			const InputData &next = _inputFIFO.readRef(j + 1);
+			if (next.pinIndex != p || (next.state & kInputResync))
+				break;
+			++j;
+			newPinState = next.state;
+			_pins_pinState[p] = newPinState;
+		}
+		if (!pulses)
+			return j;
 
-				uint16_t delta = _decoders[i]->Decoder_pulse(reportedPinState(_decoders_pinState[i]), timeToReport);
+		Decoder *decoder = _decoders[i];
+#if INS_SCHEDULER_STATISTICS
+		ins_micros_t start = fastMicros();
+#endif
+		uint16_t delta = decoder->Decoder_pulses(firstState, pulseWidths, pulses);
+#if INS_SCHEDULER_STATISTICS
+		decoder->_statistics.add(fastMicros() - start, start - lastTransition);
+#endif
 #ifdef UNIT_TEST
-				assert(delta <= SteppedTask::kMaxSleepMicros);
+		assert(delta <= SteppedTask::kMaxSleepMicros);
 #endif
-				_decoders_pinState[i] = newPinState; // Resets timeout state
-				_decoders_nextTimeoutMicros[i] = now + delta;
-				_decoders_lastTransitionMicros[i] = now;
-			}
-			now = fastMicros();
+		if (_decoders[i] != decoder)
+		{
+			// Removed by the delegate.
+			return j;
 		}
+		_decoders_pinState[i] = pinState;
+		_decoders_lastTransitionMicros[i] = lastTransition;
+		if (delta == Decoder::kInvalidTimeout)
+			_decoders_timeouts.remove(i);
+		else
+			_decoders_timeouts.set(i, lastTransition + delta);
+		return j;
 	}
 
-	void pollInputFIFOs()
+	// Edges were lost on pin index p, restart all decoders using it.
+	// The state is set so that the next edge is always reported, as the first edge after a timeout.
+	void resyncPin(uint8_t p, uint8_t newPinState)
 	{
-		while (!_inputFIFO.empty())
+		pin_usage_t usageLeft = _pins_usage[p];
+		for (uint8_t i = 0; usageLeft && i < _maxDecoder; ++i)
 		{
-			ins_micros_t now = _inputFIFO.readRef().micros;
-			uint8_t pin = _inputFIFO.readRef().pin;
-			uint8_t newPinState = _inputFIFO.readRef().state;
-			_inputFIFO.pop();
+			pin_usage_t decoderBitMask = 1ULL << i;
+			if (!(usageLeft & decoderBitMask))
+				continue;
+			usageLeft &= ~decoderBitMask;
 
-			pin_flags_t pinIndexMask = 1ULL;
-			for (uint8_t p = 0; p < _maxPolledPin || p < _maxInterruptPin; ++p, pinIndexMask <<= 1)
+			_decoders_timeouts.remove(i);
+			_decoders_pinState[i] = (newPinState ^ PIN_STATE_REPORTED) | PIN_STATE_TIMEOUT;
+			_decoders[i]->Decoder_resync();
+		}
+		_pins_locked[p] = 0;
+		_pins_skipped[p] = 0;
+	}
+
+	// All decoders that owned pin index p have finished their frame.
+	// The decoders that missed edges see the next edge as after a timeout.
+	void unlockPin(uint8_t p, uint8_t pinState)
+	{
+		pin_usage_t skipped = _pins_skipped[p];
+		_pins_locked[p] = 0;
+		_pins_skipped[p] = 0;
+		for (uint8_t i = 0; skipped; ++i, skipped >>= 1)
+		{
+			if (skipped & 1)
+				_decoders_pinState[i] = pinState | PIN_STATE_TIMEOUT;
+		}
+	}
+
+	// Pass an edge on pin index p through its glitch filter.
+	void filterEdge(uint8_t p, uint8_t newPinState, ins_micros_t time)
+	{
+		if (!_pins_minPulse[p])
+		{
+			pulsePin(p, newPinState, time);
+			return;
+		}
+		pin_flags_t pinIndexMask = pin_flags_t(1) << p;
+		if (_pins_pending & pinIndexMask)
+		{
+			if (newPinState != _pins_filteredState[p])
+				return;
+			if (ins_micros_t(time - _pins_pendingMicros[p]) < _pins_minPulse[p])
 			{
-				if (pin != _pins_pin[p] || !_pins_usage[p])
-					continue;
-				_pins_pinState[p] = newPinState;
-				pin_usage_t usageLeft = _pins_usage[p];
-				for (uint8_t i = 0; usageLeft && i < _maxDecoder; ++i)
-				{
-					pin_usage_t decoderBitMask = 1ULL << i;
-					if (!(usageLeft & decoderBitMask))
-						continue;
-					usageLeft &= ~decoderBitMask;
-
-					if (newPinState == reportedPinState(_decoders_pinState[i]))
-					{
-						continue;
-					}
-					uint16_t timeToReport = now -_decoders_lastTransitionMicros[i];
-					if (timeoutPinState(_decoders_pinState[i]))
-					{
-						timeToReport = 0;
-					}
-					else if (timeToReport == 0)
-					{
-						timeToReport = 1;
-					}
-					uint16_t delta = _decoders[i]->Decoder_pulse(reportedPinState(_decoders_pinState[i]), timeToReport);
-#ifdef UNIT_TEST
-					assert(delta <= SteppedTask::kMaxSleepMicros);
-#endif
-					_decoders_pinState[i] = newPinState; // Resets timeout state
-					_decoders_nextTimeoutMicros[i] = now + delta;
-					_decoders_lastTransitionMicros[i] = now;
-				}
+				// Too short, drop both edges.
+				_pins_pending &= ~pinIndexMask;
+				return;
 			}
+			confirmEdge(p);
 		}
+		if (newPinState == _pins_filteredState[p])
+			return;
+		_pins_pending |= pinIndexMask;
+		_pins_pendingMicros[p] = time;
 	}
 
-	void pollTimeouts()
+	void confirmEdge(uint8_t p)
 	{
-		ins_micros_t now = fastMicros();
-		for (uint8_t i = 0; i < _maxDecoder; ++i)
+		_pins_pending &= ~(pin_flags_t(1) << p);
+		_pins_filteredState[p] ^= 1;
+		pulsePin(p, _pins_filteredState[p], _pins_pendingMicros[p]);
+	}
+
+	// Pass on held edges that have lasted minPulse.
+	// Returns the time of the earliest edge that is still held or now if none.
+	ins_micros_t pollFilters(ins_micros_t now)
+	{
+		ins_micros_t earliest = now;
+		pin_flags_t pending = _pins_pending;
+		for (uint8_t p = 0; pending; ++p, pending >>= 1)
+		{
+			if (!(pending & 1))
+				continue;
+			if (ins_smicros_t(now - _pins_pendingMicros[p]) >= ins_smicros_t(_pins_minPulse[p]))
+				confirmEdge(p);
+			else if (ins_smicros_t(_pins_pendingMicros[p] - earliest) < 0)
+				earliest = _pins_pendingMicros[p];
+		}
+		return earliest;
+	}
+
+	// Report a transition on pin index p to all decoders using it, or to the decoders it is locked to.
+	void pulsePin(uint8_t p, uint8_t newPinState, ins_micros_t now)
+	{
+		pin_usage_t locked = _pins_locked[p];
+		pin_usage_t usageLeft = locked ? locked : _pins_usage[p];
+		// Decoders with an armed timeout after this edge.
+		pin_usage_t receiving = 0;
+		for (uint8_t i = 0; usageLeft && i < _maxDecoder; ++i)
 		{
-			if (!_decoders[i])
+			pin_usage_t decoderBitMask = 1ULL << i;
+			if (!(usageLeft & decoderBitMask))
 				continue;
+			usageLeft &= ~decoderBitMask;
 
-			if (_decoders_nextTimeoutMicros[i] != _decoders_lastTransitionMicros[i])
+			if (newPinState == reportedPinState(_decoders_pinState[i]))
 			{
-				if (ins_smicros_t(_decoders_nextTimeoutMicros[i] - now) < 0)
-				{
+				if (_decoders_timeouts.queued(i))
+					receiving |= decoderBitMask;
+				continue;
+			}
+			uint16_t timeToReport = now -_decoders_lastTransitionMicros[i];
+			if (timeoutPinState(_decoders_pinState[i]))
+			{
+				timeToReport = 0;
+			}
+			else if (timeToReport == 0)
+			{
+				timeToReport = 1;
+			}
+			Decoder *decoder = _decoders[i];
+#if INS_SCHEDULER_STATISTICS
+			ins_micros_t start = fastMicros();
+#endif
+			uint16_t delta = decoder->Decoder_pulse(reportedPinState(_decoders_pinState[i]), timeToReport);
+#if INS_SCHEDULER_STATISTICS
+			decoder->_statistics.add(fastMicros() - start, start - now);
+#endif
+#ifdef UNIT_TEST
+			assert(delta <= SteppedTask::kMaxSleepMicros);
+#endif
+			if (_decoders[i] != decoder)
+			{
+				// Removed by the delegate.
+				continue;
+			}
+			_decoders_pinState[i] = newPinState; // Resets timeout state
+			_decoders_lastTransitionMicros[i] = now;
+			if (delta == Decoder::kInvalidTimeout)
+			{
+				_decoders_timeouts.remove(i);
+			}
+			else
+			{
+				_decoders_timeouts.set(i, now + delta);
+				receiving |= decoderBitMask;
+			}
+		}
+
+		if (!(_pins_classify & (pin_flags_t(1) << p)))
+			return;
+		if (locked)
+			_pins_skipped[p] |= _pins_usage[p] & ~locked;
+		if (receiving)
+			_pins_locked[p] = receiving;
+		else if (locked)
+			unlockPin(p, newPinState);
+	}
+
+	void pollTimeouts(ins_micros_t now)
+	{
+		// Idle decoders are not queued so this is usually all that runs.
+		while (_decoders_timeouts.expired(now))
+		{
+			uint8_t i = _decoders_timeouts.top();
+			_decoders_timeouts.remove(i);
 #ifdef INS_TIMEOUT_DEBUG_PIN
-					static uint8_t s_timeoutToggle;
-					s_timeoutToggle ^= 1;
-					digitalWrite(INS_TIMEOUT_DEBUG_PIN, s_timeoutToggle);
+			static uint8_t s_timeoutToggle;
+			s_timeoutToggle ^= 1;
+			digitalWrite(INS_TIMEOUT_DEBUG_PIN, s_timeoutToggle);
 #endif
-					_decoders[i]->Decoder_timeout(reportedPinState(_decoders_pinState[i]));
-					_decoders_pinState[i] |= PIN_STATE_TIMEOUT;
-					_decoders_nextTimeoutMicros[i] = _decoders_lastTransitionMicros[i];
-				}
+#if INS_SCHEDULER_STATISTICS
+			Decoder *decoder = _decoders[i];
+			ins_micros_t start = fastMicros();
+			decoder->Decoder_timeout(reportedPinState(_decoders_pinState[i]));
+			decoder->_statistics.add(fastMicros() - start, start - _decoders_timeouts.deadline(i));
+#else
+			_decoders[i]->Decoder_timeout(reportedPinState(_decoders_pinState[i]));
+#endif
+			_decoders_pinState[i] |= PIN_STATE_TIMEOUT;
+
+			uint8_t p = _decoders_pinIndex[i];
+			pin_usage_t decoderBitMask = pin_usage_t(1) << i;
+			if (_pins_locked[p] & decoderBitMask)
+			{
+				_pins_locked[p] &= ~decoderBitMask;
+				if (!_pins_locked[p])
+					unlockPin(p, reportedPinState(_decoders_pinState[i]));
 			}
 		}
 	}
@@ -824,34 +1608,159 @@ private:
 	void pollTasks()
 	{
 		ins_micros_t now = fastMicros();
-		for (uint8_t i = 0 ; i < _maxTask; ++i)
+		if (!_tasks_queue.due(now))
+			return;
+
+		// Collect all due tasks first so that each task is stepped at most once per poll,
+		// even when it returns a zero delay.
+		uint8_t due[INS_SEQUENCER_MAX_NUM_TASKS];
+		uint8_t numDue = 0;
+		do
+		{
+			uint8_t i = _tasks_queue.top();
+			_tasks_queue.remove(i);
+			due[numDue++] = i;
+		} while (_tasks_queue.due(now));
+
+		for (uint8_t d = 0; d < numDue; ++d)
 		{
-			if (!_tasks_task[i])
+			uint8_t i = due[d];
+			SteppedTask *task = _tasks_task[i];
+			// Skip tasks that were removed, or removed and re-added, by a previous step.
+			if (!task || _tasks_queue.queued(i))
 				continue;
-			ins_smicros_t timeLeft = _tasks_targetTime[i] - now;
-			if (timeLeft > 0)
+			if (task->_longSleepMicros)
 			{
+				// Rest of a long sleep, the task is not stepped.
+				_tasks_queue.set(i, _tasks_queue.deadline(i) + task->sleepChunk());
 				continue;
 			}
-			uint16_t delta = _tasks_task[i]->SteppedTask_step();
+#if INS_SCHEDULER_STATISTICS
+			ins_micros_t start = fastMicros();
+			uint16_t delta = task->SteppedTask_step();
+			now = fastMicros();
+			task->_statistics.add(now - start, start - _tasks_queue.deadline(i));
+#else
+			uint16_t delta = task->SteppedTask_step();
 			now = fastMicros();
+#endif
+			if (_tasks_task[i] != task || _tasks_queue.queued(i))
+				continue;
+			if (delta == SteppedTask::kInvalidDelta)
+			{
+				Delegate *delegate = _tasks_delegate[i];
+				freeTask(i);
+				if (delegate)
+					delegate->SchedulerDelegate_done(task);
+				continue;
+			}
 			if (_taskIsAbsolute & (1ULL << i))
 				// Try to keep up with absolute time.
 				// This may lead to shorter delays when attempting to keep up.
-				_tasks_targetTime[i] += delta;
+				_tasks_queue.set(i, _tasks_queue.deadline(i) + taskDelay(task, delta));
 			else
 				// Always wait at least the delay
-				_tasks_targetTime[i] = now + delta;
-			if (delta == SteppedTask::kInvalidDelta)
-			{
-				SteppedTask *task = _tasks_task[i];
-				_tasks_task[i] = nullptr;
-				if (_tasks_delegate[i])
-					_tasks_delegate[i]->SchedulerDelegate_done(task);
-				continue;
-			}
+				_tasks_queue.set(i, now + taskDelay(task, delta));
+		}
+	}
+
+	static ins_micros_t taskDelay(SteppedTask *task, uint16_t delta)
+	{
+		return delta == SteppedTask::kLongSleep ? task->sleepChunk() : delta;
+	}
+
+	uint8_t allocateTask(SteppedTask *task, Delegate *delegate, bool absolute)
+	{
+		if (active(task))
+		{
+			InsError(*(uint32_t*)"dupl");
+			return kNoSlot;
+		}
+		if (!_numFreeTasks)
+		{
+			InsError(*(uint32_t*)"tovf");
+			return kNoSlot;
 		}
+		uint8_t i = _tasks_free[--_numFreeTasks];
+		_tasks_task[i] = task;
+		_tasks_delegate[i] = delegate;
+		task->_schedulerSlot = i;
+		task->_longSleepMicros = 0;
+		task_flags_t bitMask = 1ULL << i;
+		_taskIsAbsolute &= ~bitMask;
+		if (absolute)
+			_taskIsAbsolute |= bitMask;
+		return i;
+	}
+
+	void freeTask(uint8_t i)
+	{
+		_tasks_task[i] = nullptr;
+		_tasks_free[_numFreeTasks++] = i;
+	}
+
+	uint8_t taskSlot(SteppedTask *task)
+	{
+		uint8_t i = task->_schedulerSlot;
+		if (i < INS_SEQUENCER_MAX_NUM_TASKS && _tasks_task[i] == task)
+			return i;
+		return kNoSlot;
+	}
+};
+
+// Pin interrupt trampolines, one per interrupt slot so that no heap allocation is needed.
+template <uint8_t P>
+struct PinISR
+{
+	INS_IRAM_ATTR static void isr() { Scheduler::pinInterrupt(P); }
+	static void (*get(uint8_t p))() { return p == P ? isr : PinISR<P - 1>::get(p); }
+};
+
+template <>
+struct PinISR<0>
+{
+	INS_IRAM_ATTR static void isr() { Scheduler::pinInterrupt(0); }
+	static void (*get(uint8_t /*p*/))() { return isr; }
+};
+
+inline void (*Scheduler::pinISR(uint8_t slot))()
+{
+	return PinISR<INS_MAX_PIN_INTERRUPTS - 1>::get(slot);
+}
+
+// Typed lock-free hand-off from one thread or core to another, e.g. from decoder delegates to transmit tasks.
+// One sender and one receiver. The receiving Scheduler, if any, is woken in its startTask() task on send.
+template<typename T, size_t N>
+class Channel
+{
+	LockFreeFIFO<T, N> _fifo;
+	Scheduler *_receiver;
+public:
+	Channel(Scheduler *receiver = nullptr) : _receiver(receiver) {}
+
+	// Returns false if full.
+	bool send(const T &value)
+	{
+		if (_fifo.full())
+			return false;
+		_fifo.writeRef() = value;
+		_fifo.push();
+		if (_receiver)
+			_receiver->wake();
+		return true;
+	}
+
+	// Returns false if empty.
+	bool receive(T &value)
+	{
+		if (_fifo.empty())
+			return false;
+		value = _fifo.readRef();
+		_fifo.pop();
+		return true;
 	}
+
+	bool empty() const { return _fifo.empty(); }
 };
 
 }
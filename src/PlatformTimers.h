@@ -8,12 +8,29 @@
 namespace inseparates
 {
 
+// Ticks of the 750 kHz SAMD timer clock in micros, limited to the 16-bit counter.
+// micros * 3 / 4 without overflowing 32 bits.
+inline uint16_t samdTimerTicks(unsigned long micros)
+{
+	uint32_t ticks = micros / 4 * 3 + (micros % 4) * 3 / 4;
+	if (ticks == 0)
+		return 1;
+	if (ticks > 0xFFFF)
+		return 0xFFFF;
+	return ticks;
+}
+
 #ifdef ESP8266
 #define INS_HAVE_HW_TIMER 1
 
 class HWTimer
 {
+	void (*_callback)(void) = nullptr;
+
 public:
+	// 23-bit counter at 5 MHz.
+	static const unsigned long kMaxOneShotMicros = 0x7FFFFF / 5;
+
 	~HWTimer()
 	{
 		timer1_disable();
@@ -23,10 +40,25 @@ public:
 	{
 		timer1_disable();
 		timer1_attachInterrupt(callback);
+		_callback = callback;
 		timer1_isr_init();
 		timer1_enable(TIM_DIV16, TIM_EDGE, TIM_LOOP);
 		timer1_write(interval * 5);
 	}
+
+	// Calls callback once after delay, replaces any armed interrupt. Can be called from callback.
+	INS_IRAM_ATTR void attachInterruptOneShot(const unsigned long &delay, void (*callback)(void))
+	{
+		if (_callback != callback)
+		{
+			timer1_disable();
+			timer1_attachInterrupt(callback);
+			_callback = callback;
+			timer1_isr_init();
+		}
+		timer1_enable(TIM_DIV16, TIM_EDGE, TIM_SINGLE);
+		timer1_write(delay * 5);
+	}
 };
 #endif
 
@@ -36,8 +68,11 @@ public:
 class HWTimer
 {
 	hw_timer_t *_timer = nullptr;
+	void (*_callback)(void) = nullptr;
 
 public:
+	static const unsigned long kMaxOneShotMicros = 0x7FFFFFFF;
+
 	HWTimer() :
 #if ESP_IDF_VERSION_MAJOR < 5
 		_timer(timerBegin(0, 80, true))
@@ -66,6 +101,28 @@ public:
 #else
 		timerAttachInterrupt(_timer, callback);
 		timerAlarm(_timer, interval, true, 0);
+#endif
+		_callback = callback;
+	}
+
+	// Calls callback once after delay, replaces any armed interrupt. Can be called from callback.
+	INS_IRAM_ATTR void attachInterruptOneShot(const unsigned long &delay, void (*callback)(void))
+	{
+		if (_callback != callback)
+		{
+#if ESP_IDF_VERSION_MAJOR < 5
+			timerAttachInterrupt(_timer, callback, true);
+#else
+			timerAttachInterrupt(_timer, callback);
+#endif
+			_callback = callback;
+		}
+		timerWrite(_timer, 0);
+#if ESP_IDF_VERSION_MAJOR < 5
+		timerAlarmWrite(_timer, delay, false);
+		timerAlarmEnable(_timer);
+#else
+		timerAlarm(_timer, delay, false, 0);
 #endif
 	}
 };
@@ -84,6 +141,8 @@ public:
 	typedef void (*CallbackFunction)();
 
 	static CallbackFunction s_callback;
+	// 16-bit counter at 750 kHz.
+	static const unsigned long kMaxOneShotMicros = 0xFFFF * 4 / 3;
 
 	HWTimer()
 	{
@@ -120,10 +179,9 @@ public:
 	void attachInterruptInterval(const unsigned long interval, CallbackFunction callback)
 	{
 		s_callback = callback;
-		uint32_t tickFrequency = 48000000UL / 64UL;
-		uint16_t period = (uint16_t)((interval * tickFrequency) / 1000000UL);
-		if (period == 0)
-			period = 1;
+		uint16_t period = samdTimerTicks(interval);
+		// Wrap at the match, a previous one-shot may have set ONESHOT.
+		_tc->COUNT16.CTRLBCLR.reg = TC_CTRLBCLR_ONESHOT;
 		while (_tc->COUNT16.STATUS.bit.SYNCBUSY);
 		_tc->COUNT16.CC[0].reg = period;
 		while (_tc->COUNT16.STATUS.bit.SYNCBUSY);
@@ -134,6 +192,24 @@ public:
 		_tc->COUNT16.CTRLA.reg |= TC_CTRLA_ENABLE;
 		while (_tc->COUNT16.STATUS.bit.SYNCBUSY);
 	}
+
+	// Calls callback once after delay, replaces any armed interrupt. Can be called from callback.
+	INS_IRAM_ATTR void attachInterruptOneShot(const unsigned long delay, CallbackFunction callback)
+	{
+		s_callback = callback;
+		uint16_t period = samdTimerTicks(delay);
+		// Stop at the match instead of wrapping.
+		_tc->COUNT16.CTRLBSET.reg = TC_CTRLBSET_ONESHOT;
+		while (_tc->COUNT16.STATUS.bit.SYNCBUSY);
+		_tc->COUNT16.CC[0].reg = period;
+		while (_tc->COUNT16.STATUS.bit.SYNCBUSY);
+		_tc->COUNT16.INTENSET.reg = TC_INTENSET_MC0;
+		_tc->COUNT16.CTRLA.reg |= TC_CTRLA_ENABLE;
+		while (_tc->COUNT16.STATUS.bit.SYNCBUSY);
+		// Restart from zero.
+		_tc->COUNT16.CTRLBSET.reg = TC_CTRLBSET_CMD_RETRIGGER;
+		while (_tc->COUNT16.STATUS.bit.SYNCBUSY);
+	}
 };
 #endif
 
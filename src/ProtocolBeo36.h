@@ -3,7 +3,7 @@
 #ifndef _INS_PROTOCOL_BEO_OLD_H_
 #define _INS_PROTOCOL_BEO_OLD_H_
 
-#include "ProtocolUtils.h"
+#include "PulseCode.h"
 
 // Old 36 kHz IR format.
 
@@ -16,69 +16,43 @@
 namespace inseparates
 {
 
-class TxBeo36 : public SteppedTask
+struct Beo36Code : PulseCode
+{
+	static constexpr uint16_t kZeroMark = 154;
+	static constexpr uint16_t kZeroSpace = 5100 - kZeroMark;
+	static constexpr uint16_t kOneMark = 154;
+	static constexpr uint16_t kOneSpace = 7100 - kOneMark;
+	static constexpr uint16_t kTrailerMark = 154;
+	static constexpr uint32_t kTrailerSpace = 14100;
+	// Start bit + six data bits.
+	static constexpr uint8_t kBits = 7;
+
+	static constexpr Coding kCoding = kSpaceWidth;
+	static constexpr uint16_t kPulseMin = 101;
+	static constexpr uint16_t kPulseMax = 249;
+	static constexpr uint16_t kZeroMin = 4500;
+	static constexpr uint16_t kZeroMax = 5699;
+	static constexpr uint16_t kOneMin = 6500;
+	static constexpr uint16_t kOneMax = 7700;
+	static constexpr uint16_t kTimeout = 2 * kOneSpace;
+};
+
+class TxBeo36 : public TxPulseCode<Beo36Code>
 {
-	friend class RxBeo36;
-
-	static const uint16_t kMarkMicros = 154;
-	static const uint16_t kT1 = 5100 - kMarkMicros; // 0
-	static const uint16_t kT2 = 7100 - kMarkMicros; // 1
-	static const uint16_t kIdleMicros = 14100;
-
-	uint8_t _data;
-	PinWriter *_pin;
-	uint8_t _mark;
-	uint8_t _count;
-	bool _sleepUntilRepeat;
 public:
 	TxBeo36(PinWriter *pin, uint8_t mark) :
-		_pin(pin), _mark(mark), _count(-1)
+		TxPulseCode(pin, mark)
 	{
 	}
 
 	void prepare(uint8_t data, bool sleepUntilRepeat = true)
 	{
-		_data = data << 1;
-		_count = -1;
-		_sleepUntilRepeat = sleepUntilRepeat;
-	}
-
-	uint16_t SteppedTask_step() override
-	{
-		++_count;
-		if (_count >= 16)
-		{
-			_count = -1;
-			return SteppedTask::kInvalidDelta;
-		}
-		bool startOfMark = !(_count & 1);
-		if (startOfMark)
-		{
-			_pin->write(_mark);
-			return kMarkMicros;
-		}
-		_pin->write(1 ^ _mark);
-		if (_count >= 15)
-		{
-			if (!_sleepUntilRepeat)
-			{
-				_count = -1;
-				return SteppedTask::kInvalidDelta;
-			}
-			return kIdleMicros;
-		}
-		uint8_t bitnum = _count >> 1;
-		bool thisBit = (_data >> bitnum) & 1;
-		if (!thisBit)
-			return kT1;
-		return kT2;
+		TxPulseCode::prepare(uint32_t(data) << 1, Beo36Code::kBits, sleepUntilRepeat);
 	}
 };
 
-class RxBeo36 : public Decoder
+class RxBeo36 : public RxPulseCode<Beo36Code>
 {
-	static const uint16_t kTimeoutMicros = 2 * TxBeo36::kT2;
-
 public:
 	class Delegate
 	{
@@ -87,98 +61,19 @@ public:
 	};
 
 private:
-	uint8_t _mark;
 	Delegate *_delegate;
-	uint8_t _bus;
-	uint8_t _lastBit;
-	uint8_t _data;
-	uint8_t _count;
 
 public:
 	RxBeo36(uint8_t mark, Delegate *delegate, uint8_t bus = 0) :
-		_mark(mark), _delegate(delegate), _bus(bus)
-	{
-		reset();
-	}
-
-	void reset()
-	{
-		_lastBit = 1;
-		_data = 0;
-		_count = -1;
-	}
-
-	void Decoder_timeout(uint8_t /*pinState*/) override
-	{
-		reset();
-	}
-
-	uint16_t Decoder_pulse(uint8_t pulseState, uint16_t pulseWidth) override
-	{
-		bool mark = pulseState == _mark;
-		if (_count == uint8_t(-1))
-		{
-			// Wait for mark
-			if (!mark)
-			{
-				return Decoder::kInvalidTimeout;
-			}
-			// Do not check for enough idle time here because pulseWidth could have wrapped.
-			++_count;
-		}
-
-		++_count;
-
-		if (mark)
-		{
-			if (!validMarkPulseWidth(pulseWidth))
-			{
-				reset();
-				return Decoder::kInvalidTimeout;
-			}
-			if (_count == 15)
-			{
-				if (_delegate)
-					_delegate->RxBeo36Delegate_data(_data >> 1, _bus);
-				reset();
-				return Decoder::kInvalidTimeout;
-			}
-			return kTimeoutMicros;
-		}
-
-		uint8_t t = validDistance(pulseWidth);
-
-		if (!t)
-		{
-			reset();
-			return Decoder::kInvalidTimeout;
-		}
-
-		_data |= (t - 1) << (_count - 2) / 2;
-		return kTimeoutMicros;
-	}
-
-private:
-	bool validMarkPulseWidth(uint16_t pulseWidth)
+		RxPulseCode(mark, bus), _delegate(delegate)
 	{
-		if (pulseWidth > 100 && pulseWidth < 250)
-		{
-			return true;
-		}
-		return false;
 	}
 
-	uint8_t validDistance(uint16_t distance)
+protected:
+	void RxPulseCode_data(uint32_t data, uint8_t /*bits*/) override
 	{
-		if (distance < 4500)
-			return 0;
-		if (distance < 5700)
-			return 1;
-		if (distance < 6500)
-			return 0;
-		if (distance > 7700)
-			return 0;
-		return 2;
+		if (_delegate)
+			_delegate->RxBeo36Delegate_data(data >> 1, _bus);
 	}
 };
 
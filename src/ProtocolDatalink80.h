@@ -43,7 +43,7 @@ public:
 	uint16_t SteppedTask_step() override
 	{
 		uint8_t sent = 0;
-		uint8_t sentValue;
+		uint8_t sentValue = 0;
 		for (;;)
 		{
 			if (_sendRepeatSpace)
@@ -131,6 +131,11 @@ public:
 		_count = -1;
 	}
 
+	void Decoder_resync() override
+	{
+		reset();
+	}
+
 	void Decoder_timeout(uint8_t pinState) override
 	{
 		if (_count == uint8_t(-1))
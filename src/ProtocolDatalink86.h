@@ -19,6 +19,7 @@
 //   The specimen used to test this code was very noisy and had a very low output current.
 //   A somewhat working fix was to put a 4n7 capacitor across the output and ground followed by a pnp emitter follower.
 //   Other samples may require a different treatment.
+//   The remaining glitches can be removed with the glitch filter in Scheduler, e.g. scheduler.add(&rx, pin, true, 40).
 //   This particular receiver also did receive lower frequencies but rather poorly and with a lower delay than usual.
 //   This makes it hard to create a functional universal receiver by paralleling a TSOP7000 with another receiver.
 //
@@ -154,6 +155,11 @@ public:
 		_count = -1;
 	}
 
+	void Decoder_resync() override
+	{
+		reset();
+	}
+
 	void Decoder_timeout(uint8_t /*pinState*/) override
 	{
 		if (_count == uint8_t(-1))
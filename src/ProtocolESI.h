@@ -109,7 +109,7 @@ public:
 				_count = _bits * 2 + 2;
 				uint16_t microsUntilRepeat = kRepeatInterval - _microsAccumulator;
 				_microsAccumulator += microsUntilRepeat;
-				return microsUntilRepeat;
+				return longSleep(microsUntilRepeat);
 			}
 			uint8_t bitnum = (_bits * 2 - 1 - _count) >> 1;
 			bool bit = (_data >> bitnum) & 1;
@@ -135,7 +135,7 @@ public:
 			_count = _bits * 2 + 2;
 			uint16_t microsUntilRepeat = kRepeatInterval - _microsAccumulator;
 			_microsAccumulator += microsUntilRepeat;
-			return microsUntilRepeat;
+			return longSleep(microsUntilRepeat);
 		}
 		uint8_t bitnum = (_bits * 2 - 1 - _count) >> 1;
 		bool bit = (_data >> bitnum) & 1;
@@ -189,6 +189,11 @@ public:
 		_count = -1;
 	}
 
+	void Decoder_resync() override
+	{
+		reset();
+	}
+
 	void Decoder_timeout(uint8_t pinState) override
 	{
 		if (_count == uint8_t(-1))
@@ -95,10 +95,8 @@ private:
 			prepare(_data);
 			return SteppedTask::kInvalidDelta;
 		}
-		if (microsUntilRepeat > SteppedTask::kMaxSleepMicros)
-			microsUntilRepeat = SteppedTask::kMaxSleepMicros;
 		_microsAccumulator += microsUntilRepeat;
-		return microsUntilRepeat;
+		return longSleep(microsUntilRepeat);
 	}
 };
 
@@ -133,6 +131,11 @@ public:
 		_count = -1;
 	}
 
+	void Decoder_resync() override
+	{
+		reset();
+	}
+
 	void Decoder_timeout(uint8_t /*pinState*/) override
 	{
 		if (_count == uint8_t(-1))
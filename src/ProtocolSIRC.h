@@ -13,84 +13,57 @@
 
 // Note that some Sony equipment requires more than one message to react!
 
-#include "ProtocolUtils.h"
-#include "DebugUtils.h"
+#include "PulseCode.h"
 
 namespace inseparates
 {
 
-class TxSIRC : public SteppedTask
+struct SIRCCode : PulseCode
+{
+	static constexpr uint16_t kHeaderMark = 2400;
+	static constexpr uint16_t kHeaderSpace = 600;
+	static constexpr uint16_t kZeroMark = 600;
+	static constexpr uint16_t kZeroSpace = 600;
+	static constexpr uint16_t kOneMark = 1200;
+	static constexpr uint16_t kOneSpace = 600;
+	static constexpr uint32_t kRepeatPeriod = 45000;
+	// 12, 15 or 20 bits, delivered at timeout.
+	static constexpr uint8_t kBits = 20;
+	static constexpr uint8_t kMinBits = 2;
+
+	static constexpr Coding kCoding = kMarkWidth;
+	static constexpr uint16_t kHeaderMarkMin = 2200;
+	static constexpr uint16_t kHeaderMarkMax = 3000;
+	static constexpr uint16_t kHeaderSpaceMin = 500;
+	static constexpr uint16_t kHeaderSpaceMax = 800;
+	static constexpr uint16_t kPulseMin = 500;
+	static constexpr uint16_t kPulseMax = 800;
+	static constexpr uint16_t kZeroMin = 500;
+	static constexpr uint16_t kZeroMax = 800;
+	static constexpr uint16_t kOneMin = 1050;
+	static constexpr uint16_t kOneMax = 1550;
+	static constexpr uint16_t kTimeout = kHeaderMarkMax + kPulseMin;
+};
+
+class TxSIRC : public TxPulseCode<SIRCCode>
 {
-	friend class RxSIRC;
-	static const uint16_t kStartMarkMicros = 2400;
-	static const uint16_t kStepMicros = 600;
-	static const uint16_t kRepeatInterval = 45000;
-
-	uint32_t _data;
-	uint8_t _bits;
-	PinWriter *_pin;
-	uint8_t _mark;
-	uint8_t _count;
-	uint16_t _microsAccumulator;
-	bool _sleepUntilRepeat;
 public:
 	TxSIRC(PinWriter *pin, uint8_t mark) :
-		_pin(pin), _mark(mark), _count(-1)
+		TxPulseCode(pin, mark)
 	{
 	}
 
 	void prepare(uint32_t data, uint8_t bits, bool sleepUntilRepeat = true)
 	{
-		_data = data;
-		_bits = bits;
-		_count = -1;
-		_sleepUntilRepeat = sleepUntilRepeat;
+		TxPulseCode::prepare(data, bits, sleepUntilRepeat);
 	}
 
 	// No safety belts here, can overflow!
 	static inline uint16_t encodeSIRC(uint8_t address, uint8_t command) { return (uint16_t(address) << 7) | command; }
 	static inline uint32_t encodeSIRC20(uint8_t extended, uint8_t address, uint8_t command) { return (uint32_t(extended) << 12) | (uint16_t(address) << 7) | command; }
-
-	uint16_t SteppedTask_step() override
-	{
-		++_count;
-		if (_count > (_bits << 1) + 1)
-		{
-			_count = -1;
-			return SteppedTask::kInvalidDelta;
-		}
-		bool bitBoundry = !(_count & 1);
-		_pin->write(bitBoundry ? _mark : 1 ^ _mark);
-		if (!_count)
-		{
-			_microsAccumulator = kStartMarkMicros;
-			return kStartMarkMicros;
-		}
-		if (_count == (_bits << 1) + 1)
-		{
-			if (!_sleepUntilRepeat)
-			{
-				_count = -1;
-				return SteppedTask::kInvalidDelta;
-			}
-			uint16_t microsUntilRepeat = kRepeatInterval - _microsAccumulator;
-			_microsAccumulator += microsUntilRepeat;
-			return microsUntilRepeat;
-		}
-		if (!bitBoundry)
-		{
-			_microsAccumulator += kStepMicros;
-			return kStepMicros;
-		}
-		uint8_t bitNum = (_count >> 1) - 1;
-		bool bitVal = (_data >> bitNum) & 1;
-		uint16_t sleepTime = bitVal ? kStepMicros << 1 : kStepMicros;
-		_microsAccumulator += sleepTime;
-		return sleepTime;
-	}
 };
 
-class RxSIRC : public Decoder
+class RxSIRC : public RxPulseCode<SIRCCode>
 {
 public:
 	class Delegate
@@ -100,105 +73,19 @@ public:
 	};
 
 private:
-	static const uint16_t kSIRCStartMarkMinMicros = 2200;
-	static const uint16_t kSIRCStartMarkMaxMicros = 3000;
-	static const uint16_t kSIRCShortMinMicros = 500;
-	static const uint16_t kSIRCShortMaxMicros = 800;
-	static const uint16_t kSIRCLongMinMicros = 1050;
-	static const uint16_t kSIRCLongMaxMicros = 1550;
-	static const uint16_t kTimeout = kSIRCStartMarkMaxMicros + kSIRCShortMinMicros;
-
-	uint8_t _mark;
 	Delegate *_delegate;
-	uint32_t _data;
-	uint8_t _bus;
-	uint8_t _count;
 
 public:
 	RxSIRC(uint8_t mark, Delegate *delegate, uint8_t bus = 0) :
-		_mark(mark), _delegate(delegate), _bus(bus)
-	{
-		reset();
-	}
-
-	void reset()
-	{
-		_data = 0;
-		_count = -1;
-	}
-
-	void Decoder_timeout(uint8_t pinState) override
+		RxPulseCode(mark, bus), _delegate(delegate)
 	{
-		if (_count == uint8_t(-1))
-		{
-			INS_ASSERT(0);
-			return;
-		}
-
-		if (pinState != _mark && _count > 2)
-		{
-			if (_delegate)
-				_delegate->RxSIRCDelegate_data(_data, _count >> 1, _bus);
-		}
-		reset();
 	}
 
-	uint16_t Decoder_pulse(uint8_t pulseState, uint16_t pulseWidth) override
-	{
-		bool mark = pulseState == _mark;
-		if (_count == uint8_t(-1))
-		{
-			// First mark check
-			if (!mark)
-			{
-				return Decoder::kInvalidTimeout;
-			}
-		}
-
-		_count += 1;
-
-		if (_count == 0)
-		{
-			if (pulseWidth < kSIRCStartMarkMinMicros || pulseWidth > kSIRCStartMarkMaxMicros)
-			{
-				reset();
-				return Decoder::kInvalidTimeout;
-			}
-			return kTimeout;
-		}
-
-		if (!mark)
-		{
-			if (!validatePulseWidth(pulseWidth))
-			{
-				reset();
-				return Decoder::kInvalidTimeout;
-			}
-			return kTimeout;
-		}
-
-		if (pulseWidth >= kSIRCShortMinMicros && pulseWidth <= kSIRCShortMaxMicros)
-		{
-			// Short pulse, consider as 0
-		}
-		else if (pulseWidth >= kSIRCLongMinMicros && pulseWidth <= kSIRCLongMaxMicros)
-		{
-			// Long pulse, consider as 1
-			_data |= uint32_t(1) << ((_count - 2) >> 1);
-		}
-		else
-		{
-			reset();
-			return Decoder::kInvalidTimeout;
-		}
-
-		return kTimeout;
-	}
-
-private:
-	bool validatePulseWidth(uint16_t pulseWidth)
+protected:
+	void RxPulseCode_data(uint32_t data, uint8_t bits) override
 	{
-		return (pulseWidth >= kSIRCShortMinMicros && pulseWidth <= kSIRCShortMaxMicros);
+		if (_delegate)
+			_delegate->RxSIRCDelegate_data(data, bits, _bus);
 	}
 };
 
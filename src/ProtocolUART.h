@@ -4,7 +4,9 @@
 #define _INS_PROTOCOL_UART_H_
 
 // Software UART
-// Timing accumulator will overflow for baud rates below 300
+// Bit times are fixed point with 12 fractional bits when INS_UART_FRACTIONAL_TIME is set,
+// so rounding errors do not add up over a byte at high baud rates.
+// Without INS_UART_FRACTIONAL_TIME the timing accumulator will overflow for baud rates below 300.
 
 // As UART stands for "Universal asynchronous receiver-transmitter"
 // TxUART/RxUART are kind of misnomers unless they would be combined into a single class :)
@@ -24,22 +26,39 @@ enum Parity {
 	kOdd
 };
 
-#if !defined(INS_UART_FRACTIONAL_TIME) && !AVR
-//#define INS_UART_FRACTIONAL_TIME 1
+#ifndef INS_UART_FRACTIONAL_TIME
+#if AVR
+#define INS_UART_FRACTIONAL_TIME 0
+#else
+#define INS_UART_FRACTIONAL_TIME 1
+#endif
 #endif
 
 class TxUART : public SteppedTask
 {
 	friend class RxUART;
 
-private:
+public:
 #if INS_UART_FRACTIONAL_TIME
-	uint8_t _fractionalBits;
-	uint16_t _bitWidthFixedPointMicros;
-	uint16_t _accumulatedFixedPointTime;
+	typedef uint32_t uart_time_t;
+	typedef int32_t uart_stime_t;
+	static const uint8_t kFractionalBits = 12;
 #else
-	uint16_t _bitWidthMicros;
+	typedef uint16_t uart_time_t;
+	typedef int16_t uart_stime_t;
+	static const uint8_t kFractionalBits = 0;
 #endif
+
+private:
+	uart_time_t _bitWidth;
+#if INS_UART_FRACTIONAL_TIME
+	// Time sent but not yet returned, less than a microsecond.
+	uart_time_t _accumulatedTime;
+#endif
+	// Null when sending a single byte.
+	const uint8_t *_buffer;
+	uint16_t _length;
+	uint16_t _index;
 	uint8_t _data;
 	Parity _parity;
 	uint8_t _bits;
@@ -51,18 +70,14 @@ private:
 
 public:
 	TxUART(PinWriter *pin, uint8_t mark) :
-		_parity(Parity::kNone), _bits(8), _stopBits(1), _pin(pin), _mark(mark), _count(-1)
+		_buffer(nullptr), _length(1), _index(0), _parity(Parity::kNone), _bits(8), _stopBits(1), _pin(pin), _mark(mark), _count(-1)
 	{
 		pin->write(_mark);
 	}
 
 	void setBaudrate(uint32_t baudRate)
 	{
-#if INS_UART_FRACTIONAL_TIME
-		_bitWidthFixedPointMicros = TxUART::baudToFixedPointTime(baudRate, _fractionalBits);
-#else
-		_bitWidthMicros = (uint32_t(1000000) + (baudRate >> 1)) / baudRate;
-#endif
+		_bitWidth = TxUART::bitWidth(baudRate);
 	}
 
 	void setFormat(Parity parity, uint8_t bits = 8, uint8_t stopBits = 1)
@@ -74,18 +89,31 @@ public:
 
 	void prepare(uint8_t data)
 	{
-#if INS_UART_FRACTIONAL_TIME
-		_accumulatedFixedPointTime = 0;
-#endif
+		_buffer = nullptr;
+		_length = 1;
 		_data = data;
-		_parityValue = 0;
-		_count = -1;
+		rewind();
+	}
+
+	// Send length bytes back to back, each start bit directly after the stop bits of the previous byte.
+	// The task finishes once, after the last byte, or on the first step if length is 0.
+	// data must be valid until then.
+	void prepare(const uint8_t *data, uint16_t length)
+	{
+		_buffer = data;
+		_length = length;
+		rewind();
 	}
 
 	uint16_t SteppedTask_step() override
 	{
+		if (!_length)
+		{
+			// Nothing to send.
+			return SteppedTask::kInvalidDelta;
+		}
 		uint8_t sent = 0;
-		uint8_t sentValue;
+		uint8_t sentValue = 1;
 		for (;;)
 		{
 			++_count;
@@ -123,9 +151,15 @@ public:
 				}
 				if (sent)
 				{
-					break;
+					if (_index + 1 >= _length)
+					{
+						break;
+					}
+					// The start bit of the next byte ends this pulse.
+					startByte(_buffer[++_index]);
+					continue;
 				}
-				prepare(_data);
+				rewind();
 				return SteppedTask::kInvalidDelta;
 			}
 
@@ -146,47 +180,38 @@ public:
 				_parityValue ^= bitVal;
 		}
 #if INS_UART_FRACTIONAL_TIME
-		_accumulatedFixedPointTime += sent * _bitWidthFixedPointMicros;
-		uint16_t accumulatedMicros = fixedPointToUnsigned(_accumulatedFixedPointTime, _fractionalBits);
-		_accumulatedFixedPointTime -= unsignedToFixedPoint(accumulatedMicros, _fractionalBits);
+		_accumulatedTime += sent * _bitWidth;
+		uint16_t accumulatedMicros = _accumulatedTime >> kFractionalBits;
+		_accumulatedTime -= uart_time_t(accumulatedMicros) << kFractionalBits;
 		return accumulatedMicros;
 #else
-		return sent * _bitWidthMicros;
+		return sent * _bitWidth;
 #endif
 	}
 
 private:
-#if INS_UART_FRACTIONAL_TIME
-	static inline uint16_t baudToFixedPointTime(uint32_t baudRate, uint8_t &fractionalBits)
+	// Prepare to send the buffer or byte again.
+	void rewind()
 	{
-		// Limit fractional bits to half
-		fractionalBits = 8;
-
-		// Calculate the maximum accumulated value for 16 bits for some margin.
-		uint32_t bitTimeTimes16Micros = int32_t(16000000) / baudRate;
-
-		uint32_t maxAccumulatedValue = 255;
-
-		// Decrement the number of fractional bits until the maximum accumulated value fits.
-		while (maxAccumulatedValue < bitTimeTimes16Micros)
-		{
-			--fractionalBits;
-			maxAccumulatedValue = (maxAccumulatedValue << 1) | 1;
-		}
-
-		return (uint32_t(1000000) << fractionalBits) / baudRate;
+#if INS_UART_FRACTIONAL_TIME
+		_accumulatedTime = 0;
+#endif
+		_index = 0;
+		startByte(_buffer && _length ? _buffer[0] : _data);
 	}
 
-	static inline uint32_t fixedPointToUnsigned(uint32_t fixedPointNumber, uint8_t fractionalBits)
+	void startByte(uint8_t data)
 	{
-		return fixedPointNumber >> fractionalBits;
+		_data = data;
+		_parityValue = 0;
+		_count = -1;
 	}
 
-	static inline uint32_t unsignedToFixedPoint(uint32_t fixedPointNumber, uint8_t fractionalBits)
+	// Rounded bit time for baudRate.
+	static inline uart_time_t bitWidth(uint32_t baudRate)
 	{
-		return fixedPointNumber << fractionalBits;
+		return ((uint32_t(1000000) << kFractionalBits) + (baudRate >> 1)) / baudRate;
 	}
-#endif
 };
 
 class RxUART : public Decoder
@@ -201,14 +226,12 @@ public:
 	};
 
 private:
-#if INS_UART_FRACTIONAL_TIME
-	uint8_t _fractionalBits;
-	uint16_t _bitWidthFixedPointMicros;
-	uint16_t _accumulatedFixedPointTime;
-#else
-	uint16_t _bitWidthMicros;
-	uint16_t _accumulatedTime;
-#endif
+	typedef TxUART::uart_time_t uart_time_t;
+	typedef TxUART::uart_stime_t uart_stime_t;
+
+	uart_time_t _bitWidth;
+	// Time since the start of the start bit.
+	uart_time_t _accumulatedTime;
 	uint8_t _data;
 	uint8_t _mark;
 	Delegate *_delegate;
@@ -228,11 +251,7 @@ public:
 
 	void setBaudrate(uint32_t baudRate)
 	{
-#if INS_UART_FRACTIONAL_TIME
-		_bitWidthFixedPointMicros = TxUART::baudToFixedPointTime(baudRate, _fractionalBits);
-#else
-		_bitWidthMicros = (uint32_t(1000000) + (baudRate >> 1)) / baudRate;
-#endif
+		_bitWidth = TxUART::bitWidth(baudRate);
 	}
 
 	void setFormat(Parity parity, uint8_t bits = 8)
@@ -248,6 +267,11 @@ public:
 		_count = -1;
 	}
 
+	void Decoder_resync() override
+	{
+		reset();
+	}
+
 	void Decoder_timeout(uint8_t pinState) override
 	{
 		if (_count == uint8_t(-1))
@@ -301,131 +325,300 @@ public:
 
 	uint16_t Decoder_pulse(uint8_t pulseState, uint16_t pulseWidth) override
 	{
-		bool mark = pulseState == _mark;
-
-#if INS_UART_FRACTIONAL_TIME
-		uint16_t pulseWidthFixedPoint = TxUART::unsignedToFixedPoint(pulseWidth, _fractionalBits);
-		// Allow a quarter bit timing error
-		int16_t maxErrorFixedPoint = _bitWidthFixedPointMicros >> 2;
-		_accumulatedFixedPointTime += pulseWidthFixedPoint;
-#else
-		// Allow a quarter bit timing error
-		int16_t maxError = _bitWidthMicros >> 2;
-		_accumulatedTime += pulseWidth;
-#endif
+		return pulse(pulseState, pulseWidth, maxTimingError(), stopCount());
+	}
 
-		bool atLeastOne = false;
-		for (;;)
+	uint16_t Decoder_pulses(uint8_t firstState, const uint16_t *pulseWidths, uint8_t count) override
+	{
+		uart_stime_t maxError = maxTimingError();
+		uint8_t stop = stopCount();
+		uint16_t timeout = kInvalidTimeout;
+		for (uint8_t i = 0; i < count; ++i, firstState ^= 1)
 		{
-			if (_count == uint8_t(-1))
-			{
-				// First mark check
-				// pulseWidth might have wrapped while idle and cannot be used here to check timing.
-				if (mark)
-				{
-					return kInvalidTimeout;
-				}
-#if INS_UART_FRACTIONAL_TIME
-				_accumulatedFixedPointTime = pulseWidthFixedPoint;
-#else
-				_accumulatedTime = pulseWidth;
-#endif
-				_data = 0;
-				_parityValue = 0;
-				_count = 0;
-			}
+			timeout = pulse(firstState, pulseWidths[i], maxError, stop);
+		}
+		return timeout;
+	}
 
-#if INS_UART_FRACTIONAL_TIME
-			uint32_t previousBitBoundry = _count * uint32_t(_bitWidthFixedPointMicros);
-			int32_t distanceToNextBitBoundry = (previousBitBoundry + _bitWidthFixedPointMicros) - _accumulatedFixedPointTime;
-			if (distanceToNextBitBoundry > maxErrorFixedPoint)
+protected:
+	// A byte is being received.
+	bool receiving() const { return _count != uint8_t(-1); }
+	// The received data bits.
+	// In RxUARTDelegate_timingError() and RxUARTDelegate_parityError() these are the bits received so far,
+	// only part of the byte when the error is a misaligned edge.
+	uint8_t receivedData() const { return _data; }
+	uint8_t bus() const { return _bus; }
+
+private:
+	uint16_t timeToComplete()
+	{
+		return (4 + _bits - _count) * uint16_t(_bitWidth >> TxUART::kFractionalBits);
+	}
+
+	// Allow a 3/8 bit timing error, mostly interrupt latency at high baud rates
+	uart_stime_t maxTimingError() const
+	{
+		return (_bitWidth >> 2) + (_bitWidth >> 3);
+	}
+
+	// Bit count at the stop bit, 1 is the start bit.
+	uint8_t stopCount() const
+	{
+		return _bits + (_parity == Parity::kNone ? 2 : 3);
+	}
+
+	// All bits in a pulse are handled at once, the time does not depend on the number of equal bits.
+	// maxError and stop are from maxTimingError() and stopCount().
+	uint16_t pulse(uint8_t pulseState, uint16_t pulseWidth, uart_stime_t maxError, uint8_t stop)
+	{
+		bool mark = pulseState == _mark;
+
+		if (_count == uint8_t(-1))
+		{
+			// First mark check
+			// pulseWidth might have wrapped while idle and cannot be used here to check timing.
+			if (mark)
 			{
-				if (distanceToNextBitBoundry < maxErrorFixedPoint + (_bitWidthFixedPointMicros >> 1))
-#else
-			 uint16_t previousBitBoundry = _count * _bitWidthMicros;
-			 int16_t distanceToNextBitBoundry = (previousBitBoundry + _bitWidthMicros) - _accumulatedTime;
-			 if (distanceToNextBitBoundry > maxError)
-			 {
-				if (distanceToNextBitBoundry < maxError + (_bitWidthMicros >> 1))
-#endif
-				{
-					// Less than three quarter bits but more than a quarter bit left
-					INS_DEBUGF("%hhd %d %hhd %d\n", pulseState, (int)pulseWidth, _count, (int)distanceToNextBitBoundry);
-					if (_delegate)
-						_delegate->RxUARTDelegate_timingError(_bus);
-					reset();
-					return kInvalidTimeout;
-				}
-				if (atLeastOne)
-				{
-					break;
-				}
-				INS_DEBUGF("%hhd %d %hhd %d\n", pulseState, (int)pulseWidth, _count, (int)distanceToNextBitBoundry);
-				if (_delegate)
-					_delegate->RxUARTDelegate_timingError(_bus);
-				reset();
 				return kInvalidTimeout;
 			}
+			_accumulatedTime = 0;
+			_data = 0;
+			_parityValue = 0;
+			_count = 0;
+		}
+		_accumulatedTime += uart_time_t(pulseWidth) << TxUART::kFractionalBits;
 
-			atLeastOne = true;
-			++_count;
+		// Time from the previous bit boundary to the edge, at least -maxError.
+		uart_stime_t intoBit = _accumulatedTime - _count * _bitWidth;
+		uart_time_t run = uart_time_t(intoBit + maxError) / _bitWidth;
+		bool misaligned = false;
+		if (run < uart_time_t(stop - _count))
+		{
+			// Too far from a bit boundary, or no bit at all
+			uart_stime_t left = (run + 1) * _bitWidth - intoBit;
+			misaligned = !run || left < uart_stime_t(_bitWidth) - maxError;
+			if (misaligned)
+				INS_DEBUGF("%hhd %d %hhd %d\n", pulseState, (int)pulseWidth, _count, (int)left);
+		}
+		else
+		{
+			run = stop - _count;
+		}
+
+		// Bits _count + 1 to last, 1 is the start bit.
+		uint8_t first = _count + 1;
+		uint8_t last = _count + run;
+		_count = last;
+		if (mark && last >= 2)
+		{
+			if (first < 2)
+				first = 2;
+			uint8_t lastData = last < _bits + 1 ? last : _bits + 1;
+			if (first <= lastData)
+				_data |= ((2 << (lastData - first)) - 1) << (first - 2);
+			uint8_t lastParity = last < _bits + 2 ? last : _bits + 2;
+			if (_parity != Parity::kNone && first <= lastParity)
+				_parityValue ^= (lastParity - first + 1) & 1;
+		}
 
-			uint8_t bitValue = mark ? 1 : 0;
+		if (_parity != Parity::kNone && last >= _bits + 2 && (_parity == kEven ? 0 : 1) != _parityValue)
+		{
+			INS_DEBUGF("%hhX %hhd\n", _data, _parityValue);
+			if (_delegate)
+				_delegate->RxUARTDelegate_parityError(_bus);
+			_count = -1;
+			return kInvalidTimeout;
+		}
 
-			if (_count == 1)
-			{
-				// Start Bit
-				continue;
-			}
-			if (_count < _bits + 2)
-			{
-				// Data
-				_data |= bitValue << (_count - 2);
-				if (_parity == Parity::kNone)
-					continue;
-			}
-			if (_count >= _bits + 2 + (_parity == Parity::kNone ? 0 : 1))
+		if (last >= stop)
+		{
+			// Stop
+			if (!mark)
 			{
-				// Stop
-				if (!mark)
-				{
-					INS_DEBUGF("%hhd %d %hhd\n", pulseState, (int)pulseWidth, _count);
+				INS_DEBUGF("%hhd %d %hhd\n", pulseState, (int)pulseWidth, _count);
+				if (_delegate)
 					_delegate->RxUARTDelegate_timingError(_bus);
-				}
-				else if (_delegate)
-				{
-					_delegate->RxUARTDelegate_data(_data, _bus);
-				}
-				_count = -1;
-				return kInvalidTimeout;
 			}
-
-			if (_count < _bits + 3)
+			else if (_delegate)
 			{
-				// Parity
-				_parityValue ^= bitValue;
+				_delegate->RxUARTDelegate_data(_data, _bus);
 			}
+			_count = -1;
+			return kInvalidTimeout;
+		}
 
-			if (_count == _bits + 2 && (_parity == kEven ? 0 : 1) != _parityValue)
-			{
-				INS_DEBUGF("%hhX %hhd\n", _data, _parityValue);
-				if (_delegate)
-					_delegate->RxUARTDelegate_parityError(_bus);
-				_count = -1;
-				return kInvalidTimeout;
-			}
+		if (misaligned)
+		{
+			if (_delegate)
+				_delegate->RxUARTDelegate_timingError(_bus);
+			reset();
+			return kInvalidTimeout;
 		}
 		return timeToComplete();
 	}
+};
+
+// RxUART that stores the received bytes in a ring buffer of N bytes
+// and calls its delegate when a trigger condition is met instead of once per byte.
+// Bytes with parity or timing errors are stored too, with the error flag set.
+// Bytes received when the buffer is full are dropped and counted.
+template<uint16_t N>
+class RxUARTBuffer : private RxUART::Delegate, public RxUART
+{
+public:
+	enum Trigger : uint8_t
+	{
+		kTriggerCount,
+		kTriggerTerminator,
+		kTriggerIdle,
+		kTriggerFull,
+	};
+
+	class Delegate
+	{
+	public:
+		// Read the bytes with available(), peek(), error() and pop(), bytes left are kept.
+		virtual void RxUARTBufferDelegate_data(Trigger trigger, uint8_t bus) = 0;
+	};
 
 private:
-	uint16_t timeToComplete()
+	uint8_t _buffer[N];
+	uint8_t _errors[(N + 7) / 8];
+	uint16_t _read = 0;
+	uint16_t _size = 0;
+	uint16_t _sinceTrigger = 0;
+	uint16_t _overflows = 0;
+	uint16_t _triggerCount = 0;
+	int16_t _terminator = -1;
+	uint16_t _idleMicros = 0;
+	// RxUART::Decoder_timeout() reports a timing error and then completes the frame anyway.
+	bool _inTimeout = false;
+	bool _timeoutError = false;
+	Delegate *_delegate;
+
+public:
+	RxUARTBuffer(uint8_t mark, Delegate *delegate, uint8_t bus = 0) :
+		RxUART(mark, this, bus), _delegate(delegate)
 	{
-#if INS_UART_FRACTIONAL_TIME
-		uint16_t _bitWidthMicros = TxUART::fixedPointToUnsigned(_bitWidthFixedPointMicros, _fractionalBits);
-#endif
-		return (4 + _bits - _count) * _bitWidthMicros;
 	}
+
+	// count triggers when that many bytes have been received since the last trigger, zero to disable.
+	// terminator triggers on an error free byte with that value, -1 to disable.
+	// idleMicros triggers when the line has been idle that long after a byte, zero to disable.
+	// A full buffer always triggers.
+	void setTriggers(uint16_t count, int16_t terminator = -1, uint16_t idleMicros = 0)
+	{
+		INS_ASSERT(idleMicros <= Decoder::kMaxTimeout);
+		_triggerCount = count;
+		_terminator = terminator;
+		_idleMicros = idleMicros;
+	}
+
+	uint16_t available() const { return _size; }
+	uint8_t peek(uint16_t i = 0) const { return _buffer[slot(i)]; }
+	bool error(uint16_t i = 0) const { uint16_t s = slot(i); return (_errors[s >> 3] >> (s & 7)) & 1; }
+
+	void pop(uint16_t count = 1)
+	{
+		if (count > _size)
+			count = _size;
+		_read = slot(count);
+		_size -= count;
+	}
+
+	void clear()
+	{
+		_read = 0;
+		_size = 0;
+		_sinceTrigger = 0;
+	}
+
+	// Bytes dropped because the buffer was full, saturates at 0xFFFF.
+	uint16_t overflows() const { return _overflows; }
+
+	uint16_t Decoder_pulse(uint8_t pulseState, uint16_t pulseWidth) override
+	{
+		return idleTimeout(RxUART::Decoder_pulse(pulseState, pulseWidth));
+	}
+
+	uint16_t Decoder_pulses(uint8_t firstState, const uint16_t *pulseWidths, uint8_t count) override
+	{
+		return idleTimeout(RxUART::Decoder_pulses(firstState, pulseWidths, count));
+	}
+
+	void Decoder_timeout(uint8_t pinState) override
+	{
+		if (receiving())
+		{
+			_inTimeout = true;
+			_timeoutError = false;
+			RxUART::Decoder_timeout(pinState);
+			_inTimeout = false;
+		}
+		if (_idleMicros && _sinceTrigger)
+			trigger(kTriggerIdle);
+	}
+
+private:
+	uint16_t idleTimeout(uint16_t timeout) const
+	{
+		if (!_idleMicros || !_sinceTrigger)
+			return timeout;
+		// The last byte of a block can be completed by the idle timeout instead.
+		return timeout > _idleMicros ? timeout : _idleMicros;
+	}
+
+	uint16_t slot(uint16_t i) const
+	{
+		uint16_t s = _read + i;
+		return s >= N ? s - N : s;
+	}
+
+	void push(uint8_t data, bool error)
+	{
+		if (_size == N)
+		{
+			if (_overflows != 0xFFFF)
+				++_overflows;
+			return;
+		}
+		uint16_t s = slot(_size);
+		_buffer[s] = data;
+		uint8_t mask = 1 << (s & 7);
+		if (error)
+			_errors[s >> 3] |= mask;
+		else
+			_errors[s >> 3] &= ~mask;
+		++_size;
+		++_sinceTrigger;
+
+		if (_triggerCount && _sinceTrigger >= _triggerCount)
+			trigger(kTriggerCount);
+		else if (!error && data == _terminator)
+			trigger(kTriggerTerminator);
+		else if (_size == N)
+			trigger(kTriggerFull);
+	}
+
+	void trigger(Trigger trigger)
+	{
+		_sinceTrigger = 0;
+		if (_delegate)
+			_delegate->RxUARTBufferDelegate_data(trigger, bus());
+	}
+
+	void RxUARTDelegate_data(uint8_t data, uint8_t /*bus*/) override { push(data, _inTimeout && _timeoutError); }
+
+	void RxUARTDelegate_timingError(uint8_t /*bus*/) override
+	{
+		// Store each frame once, a timeout reports the completed frame next.
+		if (_inTimeout)
+			_timeoutError = true;
+		else
+			push(receivedData(), true);
+	}
+
+	void RxUARTDelegate_parityError(uint8_t /*bus*/) override { push(receivedData(), true); }
 };
 
 }
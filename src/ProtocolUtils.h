@@ -3,21 +3,35 @@
 #ifndef _INS_PROTOCOL_UTILS_H_
 #define _INS_PROTOCOL_UTILS_H_
 
-#ifndef INS_OUTPUT_FIFO_CHANNEL_COUNT
+// Writes queued per output pin, refills are scheduled before a FIFO runs dry.
+// Each InterruptPinWriter and InterruptPWMPinWriter owns a FIFO of this length with 8 bytes per write,
+// so any number of pins can be written concurrently. 0 disables InterruptWriteScheduler.
+#ifndef INS_OUTPUT_FIFO_LENGTH
 #ifdef AVR
-#define INS_OUTPUT_FIFO_CHANNEL_COUNT 0
+#define INS_OUTPUT_FIFO_LENGTH 0
 #elif defined(ESP32)
-#define INS_OUTPUT_FIFO_CHANNEL_COUNT 4
+#define INS_OUTPUT_FIFO_LENGTH 256
 #else
-#define INS_OUTPUT_FIFO_CHANNEL_COUNT 2
+#define INS_OUTPUT_FIFO_LENGTH 128
+#endif
+#endif
+
+// Tasks waiting for a busy pin, for all pins together.
+#ifndef INS_OUTPUT_MAX_QUEUED_TASKS
+#define INS_OUTPUT_MAX_QUEUED_TASKS 16
 #endif
+
+// Collect OutputStatistics in InterruptWriteScheduler.
+#ifndef INS_OUTPUT_STATISTICS
+#define INS_OUTPUT_STATISTICS 0
 #endif
 
-#ifndef INS_OUTPUT_FIFO_CHANNEL_LENGTH
-#if defined(ESP32)
-#define INS_OUTPUT_FIFO_LENGTH 1024
+// Maximum number of steps in an EdgeList.
+#ifndef INS_EDGE_LIST_LENGTH
+#ifdef AVR
+#define INS_EDGE_LIST_LENGTH 72
 #else
-#define INS_OUTPUT_FIFO_LENGTH 256
+#define INS_EDGE_LIST_LENGTH 136
 #endif
 #endif
 
@@ -30,11 +44,6 @@
 #define USE_PIN_PERIPHERAL 1
 #endif
 
-#if INS_OUTPUT_FIFO_CHANNEL_COUNT
-#include <vector>
-#include <map>
-#endif
-
 namespace inseparates
 {
 
@@ -485,7 +494,6 @@ class TxJam : public SteppedTask
 	uint8_t _mark;
 	uint32_t _length;
 	uint8_t _count;
-	uint32_t _microsSinceStart;
 public:
 	TxJam(PinWriter *pin, uint8_t mark, uint32_t length) :
 		_pin(pin), _mark(mark), _length(length), _count(-1)
@@ -504,37 +512,246 @@ public:
 		++_count;
 		if (!_count)
 		{
-			_microsSinceStart = 0;
 			_pin->write(_mark);
-			return _length;
+			return longSleep(_length);
+		}
+		_pin->write(1 ^ _mark);
+		_count = -1;
+		return kInvalidDelta;
+	}
+};
+
+// Steps and writes of a task, rendered once and replayed by EdgePlayer.
+// Render with a task that writes to the EdgeList.
+class EdgeList : public PinWriter
+{
+	friend class EdgePlayer;
+
+	static const uint8_t kNoWrite = 0xFF;
+	static_assert(INS_EDGE_LIST_LENGTH < 0xFF, "INS_EDGE_LIST_LENGTH too large");
+
+	uint16_t _delays[INS_EDGE_LIST_LENGTH];
+	uint8_t _levels[INS_EDGE_LIST_LENGTH];
+	uint8_t _size = 0;
+	// Sleep after the last write, usually the time until repeat.
+	uint32_t _tailMicros = 0;
+
+public:
+	uint8_t size() const { return _size; }
+	uint32_t tailMicros() const { return _tailMicros; }
+
+	// Steps task until it stops.
+	// Each step may write at most once.
+	// Returns false if the task needs more than INS_EDGE_LIST_LENGTH steps.
+	bool render(SteppedTask *task)
+	{
+		_size = 0;
+		_tailMicros = 0;
+		_levels[0] = kNoWrite;
+		for (;;)
+		{
+			uint16_t delta = task->SteppedTask_step();
+			// Not the last sleep after all.
+			if (_tailMicros && (delta != SteppedTask::kInvalidDelta || _levels[_size] != kNoWrite) && !splitTail())
+				return false;
+			if (delta == SteppedTask::kInvalidDelta)
+			{
+				if (_levels[_size] != kNoWrite)
+					return append(0);
+				return true;
+			}
+			uint32_t sleep = task->sleepMicros(delta);
+			if (sleep > SteppedTask::kMaxSleepMicros)
+			{
+				_tailMicros = sleep;
+				if (_levels[_size] != kNoWrite && !append(0))
+					return false;
+				continue;
+			}
+			if (!append(sleep))
+				return false;
+		}
+	}
+
+	void write(uint8_t value) override
+	{
+		if (_size < INS_EDGE_LIST_LENGTH)
+			_levels[_size] = value;
+	}
+
+private:
+	bool append(uint16_t delay)
+	{
+		if (_size >= INS_EDGE_LIST_LENGTH)
+		{
+			_size = 0;
+			return false;
 		}
-		if (_microsSinceStart >= _length)
+		_delays[_size++] = delay;
+		if (_size < INS_EDGE_LIST_LENGTH)
+			_levels[_size] = kNoWrite;
+		return true;
+	}
+
+	// Splits the tail into steps without writes before the write of the current step.
+	bool splitTail()
+	{
+		uint8_t level = _levels[_size];
+		_levels[_size] = kNoWrite;
+		while (_tailMicros)
+		{
+			uint16_t chunk = _tailMicros > SteppedTask::kMaxSleepMicros ? SteppedTask::kMaxSleepMicros : _tailMicros;
+			if (!append(chunk))
+				return false;
+			_tailMicros -= chunk;
+		}
+		if (_size < INS_EDGE_LIST_LENGTH)
+			_levels[_size] = level;
+		return true;
+	}
+};
+
+// Replays an EdgeList on a pin.
+class EdgePlayer : public SteppedTask
+{
+	PinWriter *_pin;
+	const EdgeList *_list = nullptr;
+	uint8_t _count;
+public:
+	EdgePlayer(PinWriter *pin) :
+		_pin(pin)
+	{
+	}
+
+	// The list must not change while playing.
+	void prepare(const EdgeList *list)
+	{
+		_list = list;
+		_count = 0;
+	}
+
+	uint16_t SteppedTask_step() override
+	{
+		if (_count >= _list->_size)
 		{
-			_pin->write(1 ^ _mark);
-			_count = -1;
+			if (_count++ == _list->_size && _list->_tailMicros)
+				return longSleep(_list->_tailMicros);
+			_count = 0;
 			return kInvalidDelta;
 		}
-		_microsSinceStart += kMaxSleepMicros;
-		if (_length - _microsSinceStart > kMaxSleepMicros)
-			return kMaxSleepMicros;
-		return _length - _microsSinceStart;
+		uint8_t level = _list->_levels[_count];
+		if (level != EdgeList::kNoWrite)
+			_pin->write(level);
+		return _list->_delays[_count++];
+	}
+};
+
+// Least recently used cache of rendered tasks.
+// Renderer tasks must be constructed with the cache as their PinWriter.
+template<uint8_t N>
+class EdgeListCache : public PinWriter
+{
+	EdgeList _lists[N];
+	const SteppedTask *_renderers[N];
+	uint64_t _data[N];
+	uint16_t _lastUse[N];
+	uint16_t _uses = 0;
+	EdgeList *_rendering = nullptr;
+
+public:
+	EdgeListCache()
+	{
+		for (uint8_t i = 0; i < N; ++i)
+		{
+			_renderers[i] = nullptr;
+			_lastUse[i] = 0;
+		}
+	}
+
+	// Returns the list for renderer and data, renders the prepared renderer if not cached.
+	// data must identify everything the renderer was prepared with.
+	// Returns nullptr if rendering fails.
+	const EdgeList *get(SteppedTask *renderer, uint64_t data)
+	{
+		uint8_t oldest = 0;
+		for (uint8_t i = 0; i < N; ++i)
+		{
+			if (_renderers[i] == renderer && _data[i] == data)
+			{
+				_lastUse[i] = ++_uses;
+				return &_lists[i];
+			}
+			if (uint16_t(_uses - _lastUse[i]) > uint16_t(_uses - _lastUse[oldest]))
+				oldest = i;
+		}
+		_rendering = &_lists[oldest];
+		bool rendered = _rendering->render(renderer);
+		_rendering = nullptr;
+		if (!rendered)
+		{
+			_renderers[oldest] = nullptr;
+			return nullptr;
+		}
+		_renderers[oldest] = renderer;
+		_data[oldest] = data;
+		_lastUse[oldest] = ++_uses;
+		return &_lists[oldest];
+	}
+
+	void write(uint8_t value) override
+	{
+		if (_rendering)
+			_rendering->write(value);
 	}
 };
 
-#if (INS_HAVE_HW_TIMER || UNIT_TEST) && INS_OUTPUT_FIFO_CHANNEL_COUNT
-INS_IRAM_ATTR void timerISR();
+#if (INS_HAVE_HW_TIMER || UNIT_TEST) && INS_OUTPUT_FIFO_LENGTH
+INS_IRAM_ATTR inline void timerISR();
+
+#if INS_OUTPUT_STATISTICS
+// Written by timerISR(), each field can be read from the main loop.
+// Lateness is how much later than requested a write was applied, negative is early.
+// All times are in microseconds.
+struct OutputStatistics
+{
+	uint32_t edges;
+	int32_t totalLateness;
+	ins_smicros_t minLateness;
+	ins_smicros_t maxLateness;
+	// Fewest writes left in the FIFO after a write while its task was still running.
+	uint16_t lowWater;
+
+	OutputStatistics() { reset(); }
+
+	void reset()
+	{
+		edges = 0;
+		totalLateness = 0;
+		minLateness = ins_smicros_t(ins_micros_t(-1) >> 1);
+		maxLateness = -minLateness - 1;
+		lowWater = 0xFFFF;
+	}
+
+	ins_smicros_t meanLateness() const { return edges ? totalLateness / int32_t(edges) : 0; }
+
+	INS_IRAM_ATTR void add(ins_smicros_t late)
+	{
+		++edges;
+		totalLateness += late;
+		if (late < minLateness)
+			minLateness = late;
+		if (late > maxLateness)
+			maxLateness = late;
+	}
+};
+#endif
 
 class InterruptWriteScheduler : public SteppedTask
 {
 	friend class InterruptPinWriter;
+	friend class InterruptPWMPinWriter;
+	friend void timerISR();
 
-	struct TaskData
-	{
-		SteppedTask *task;
-		Scheduler::Delegate *delegate;
-		ins_micros_t micros;
-		uint8_t pin;
-	};
 	struct OutputData
 	{
 		ins_micros_t micros;
@@ -542,28 +759,84 @@ class InterruptWriteScheduler : public SteppedTask
 		uint8_t state;
 		uint8_t mode;
 	};
+	// Pool entry, linked into the free list or the wait queue of a channel.
+	struct QueuedTask
+	{
+		SteppedTask *task;
+		Scheduler::Delegate *delegate;
+		uint8_t next;
+	};
+
+	static const uint8_t kNoEntry = 0xFF;
+	static_assert(INS_OUTPUT_MAX_QUEUED_TASKS < kNoEntry, "INS_OUTPUT_MAX_QUEUED_TASKS too large");
+
+	// Output FIFO of one pin, owned by its pin writer.
+	// Pins never share a FIFO, so writes on one pin never wait for another pin.
+	struct OutputChannel
+	{
+		LockFreeFIFO<OutputData, INS_OUTPUT_FIFO_LENGTH> fifo;
+		SteppedTask *task = nullptr;
+		Scheduler::Delegate *delegate = nullptr;
+		// Finished task with a pending done callback, no new task starts until it has run.
+		SteppedTask *done = nullptr;
+		// Time of the next write of task.
+		ins_micros_t micros = 0;
+		PinWriter *carrier = nullptr;
+		OutputChannel *volatile next = nullptr;
+		// Tasks waiting for this pin, in order.
+		uint8_t waitHead = kNoEntry;
+		uint8_t waitTail = kNoEntry;
+		uint8_t pin = 0;
+#if INS_OUTPUT_STATISTICS
+		OutputStatistics statistics;
+#endif
+	};
 
 public:
+	// Outputs are written when less than this is left in one-shot mode.
+	static const uint8_t kOneShotMarginMicros = 2;
+	// OutputData mode for writes that gate the carrier of the channel.
+	static const uint8_t kCarrierMode = 0xFE;
+
 	uint16_t _pollIntervalMicros;
+	bool _oneShot;
 private:
-	LockFreeFIFO<OutputData, INS_OUTPUT_FIFO_LENGTH> _outputFIFO[INS_OUTPUT_FIFO_CHANNEL_COUNT];
-	OutputData *_writeRef;
-	TaskData _outputFIFO_current[INS_OUTPUT_FIFO_CHANNEL_COUNT];
-	std::vector<TaskData> _waitlist;
-	std::vector<TaskData> _donelist;
+	// Channels of all pin writers, in the order they were created.
+	OutputChannel *volatile _channels = nullptr;
+	OutputData *_writeRef = nullptr;
+	OutputChannel *_writeChannel = nullptr;
+	QueuedTask _queued[INS_OUTPUT_MAX_QUEUED_TASKS];
+	uint8_t _freeHead;
 #ifndef UNIT_TEST
 	HWTimer _timer;
 #endif
 public:
-	InterruptWriteScheduler(uint16_t pollIntervalMicros) :
-		_pollIntervalMicros(pollIntervalMicros)
+	// pollIntervalMicros is the timer interval, or with oneShot the time from add() to the first write.
+	// With oneShot the timer is armed for the next due write instead of running continuously.
+	InterruptWriteScheduler(uint16_t pollIntervalMicros, bool oneShot = false) :
+		_pollIntervalMicros(pollIntervalMicros),
+		_oneShot(oneShot)
 	{
-		instance(this);
-		memset(_outputFIFO_current, 0, sizeof(_outputFIFO_current));
+		INS_ASSERT(!instance());
+		instance() = this;
+		for (uint8_t i = 0; i < INS_OUTPUT_MAX_QUEUED_TASKS; ++i)
+			_queued[i].next = i + 1 < INS_OUTPUT_MAX_QUEUED_TASKS ? i + 1 : kNoEntry;
+		_freeHead = 0;
+	}
+
+	~InterruptWriteScheduler()
+	{
+#ifdef UNIT_TEST
+		detachInterruptInterval();
+		detachInterruptOneShot();
+#endif
+		instance() = nullptr;
 	}
 
 	void begin()
 	{
+		if (_oneShot)
+			return;
 #ifdef UNIT_TEST
 		attachInterruptInterval(_pollIntervalMicros, timerISR);
 #else
@@ -571,125 +844,223 @@ public:
 #endif
 	}
 
-	void add(SteppedTask *task, uint8_t pin, Scheduler::Delegate *delegate = nullptr)
+	INS_IRAM_ATTR void armTimer(uint32_t delay)
 	{
-		TaskData td = {task, delegate, 0, pin};
-		if (!activate(td))
+#ifdef UNIT_TEST
+		attachInterruptOneShot(delay, timerISR);
+#else
+		if (delay > HWTimer::kMaxOneShotMicros)
+			delay = HWTimer::kMaxOneShotMicros;
+		_timer.attachInterruptOneShot(delay, timerISR);
+#endif
+	}
+
+	// Starts task now or when pin is free.
+	// Tasks on the same pin run in the order they are added.
+	// pin must have an InterruptPinWriter or InterruptPWMPinWriter.
+	bool add(SteppedTask *task, uint8_t pin, Scheduler::Delegate *delegate = nullptr)
+	{
+		OutputChannel *channel = findChannel(pin);
+		if (!channel)
 		{
-			_waitlist.push_back(td);
+			InsError(*(uint32_t*)"wpin");
+			return false;
 		}
+		if (channel->waitHead == kNoEntry && start(channel, task, delegate))
+			return true;
+		uint8_t entry = allocate(task, delegate);
+		if (entry == kNoEntry)
+			return false;
+		append(channel->waitHead, channel->waitTail, entry);
+		return true;
 	}
 
 	uint16_t SteppedTask_step() override
 	{
-		while (_donelist.size())
+		for (OutputChannel *channel = _channels; channel; channel = channel->next)
 		{
-			TaskData &td = _donelist.front();
-			td.delegate->SchedulerDelegate_done(td.task);
-			_donelist.erase(_donelist.begin());
-		}
+			if (channel->done)
+			{
+				SteppedTask *task = channel->done;
+				channel->done = nullptr;
+				// The callback may add the next task for this pin.
+				channel->delegate->SchedulerDelegate_done(task);
+			}
 
-		for (uint8_t i = 0; i < INS_OUTPUT_FIFO_CHANNEL_COUNT; ++i)
-		{
-			if (_outputFIFO_current[i].task)
+			if (channel->task)
+			{
+				push(channel, false);
+			}
+			else if (channel->waitHead != kNoEntry && !channel->done)
 			{
-				push(i, false);
+				uint8_t entry = channel->waitHead;
+				channel->waitHead = _queued[entry].next;
+				QueuedTask queued = _queued[entry];
+				release(entry);
+				start(channel, queued.task, queued.delegate);
 			}
 		}
 
-		for (uint8_t i = 0; i < _waitlist.size(); ++i)
+		// Refill at half the time left in the channel that runs dry first.
+		ins_micros_t now = fastMicros();
+		uint16_t delay = _pollIntervalMicros * 10;
+		for (OutputChannel *channel = _channels; channel; channel = channel->next)
 		{
-			TaskData &td = _waitlist[i];
-			if (activate(td))
-			{
-				_waitlist.erase(_waitlist.begin() + i);
-				--i;
-			}
+			if (!channel->task)
+				continue;
+			ins_smicros_t left = channel->micros - now;
+			if (left < 2 * ins_smicros_t(delay))
+				delay = left > 2 * ins_smicros_t(_pollIntervalMicros) ? left / 2 : _pollIntervalMicros;
 		}
-		return _pollIntervalMicros * 10;
+		return delay;
 	}
 
-	INS_IRAM_ATTR LockFreeFIFO<OutputData, INS_OUTPUT_FIFO_LENGTH> &outputFIFO(uint8_t fifo) { return _outputFIFO[fifo]; }
+#if INS_OUTPUT_STATISTICS
+	// Not synchronized with timerISR(), call when no writes are queued.
+	void resetStatistics()
+	{
+		for (OutputChannel *channel = _channels; channel; channel = channel->next)
+			channel->statistics.reset();
+	}
+#endif
 
-	INS_IRAM_ATTR static InterruptWriteScheduler *instance(InterruptWriteScheduler *timer = nullptr)
+	INS_IRAM_ATTR static InterruptWriteScheduler *&instance()
 	{
 		static InterruptWriteScheduler *s_instance;
-		if (timer)
-		{
-			INS_ASSERT(!s_instance);
-			s_instance = timer;
-		}
 		return s_instance;
 	}
 
 private:
-	bool activate(TaskData &td)
+	OutputChannel *findChannel(uint8_t pin)
 	{
-		for (uint8_t i = 0; i < INS_OUTPUT_FIFO_CHANNEL_COUNT; ++i)
+		for (OutputChannel *channel = _channels; channel; channel = channel->next)
 		{
-			if (_outputFIFO_current[i].pin == td.pin)
-			{
-				if (_outputFIFO_current[i].task)
-					return false;
-				_outputFIFO_current[i].task = td.task;
-				_outputFIFO_current[i].delegate = td.delegate;
-				push(i, _outputFIFO[i].empty());
-				return true;
-			}
+			if (channel->pin == pin)
+				return channel;
 		}
-		for (uint8_t i = 0; i < INS_OUTPUT_FIFO_CHANNEL_COUNT; ++i)
+		return nullptr;
+	}
+
+	// Called by the pin writers.
+	// With several writers on one pin the first one created is used.
+	void attach(OutputChannel *channel, uint8_t pin, PinWriter *carrier)
+	{
+		channel->pin = pin;
+		channel->carrier = carrier;
+		// Linked last and complete, timerISR() may be walking the list.
+		OutputChannel *volatile *link = &_channels;
+		while (*link)
+			link = &(*link)->next;
+		*link = channel;
+	}
+
+	void detach(OutputChannel *channel)
+	{
+		for (OutputChannel *volatile *link = &_channels; *link; link = &(*link)->next)
 		{
-			// If there's more parallel writes in progress than INS_OUTPUT_FIFO_CHANNEL_COUNT
-			// there's a risk that we go back in time on a FIFO or pin if we don't wait for all FIFOs to be empty here!
-			// That will cause overlapping or all writes to be sent in a burst!
-			// It should also be safe if all FIFOs haven't been used since they all were empty last since an unsafe ABCA cannot happen then.
-			if (_outputFIFO[i].empty())
+			if (*link != channel)
+				continue;
+			*link = channel->next;
+			while (channel->waitHead != kNoEntry)
 			{
-				_outputFIFO_current[i] = td;
-				push(i, true);
-				return true;
+				uint8_t entry = channel->waitHead;
+				channel->waitHead = _queued[entry].next;
+				release(entry);
 			}
+			return;
+		}
+	}
+
+	uint8_t allocate(SteppedTask *task, Scheduler::Delegate *delegate)
+	{
+		uint8_t entry = _freeHead;
+		if (entry == kNoEntry)
+		{
+			InsError(*(uint32_t*)"wovf");
+			return kNoEntry;
 		}
-		return false;
+		_freeHead = _queued[entry].next;
+		_queued[entry].task = task;
+		_queued[entry].delegate = delegate;
+		return entry;
+	}
+
+	void release(uint8_t entry)
+	{
+		_queued[entry].next = _freeHead;
+		_freeHead = entry;
+	}
+
+	void append(uint8_t &head, uint8_t &tail, uint8_t entry)
+	{
+		_queued[entry].next = kNoEntry;
+		if (head == kNoEntry)
+			head = entry;
+		else
+			_queued[tail].next = entry;
+		tail = entry;
 	}
 
-	bool push(uint8_t index, bool first)
+	// Starts task on channel unless the previous task or its done callback is still pending.
+	bool start(OutputChannel *channel, SteppedTask *task, Scheduler::Delegate *delegate)
+	{
+		if (channel->task || channel->done)
+			return false;
+		channel->task = task;
+		channel->delegate = delegate;
+		// Writes left from the previous task are followed, not overlapped.
+		push(channel, channel->fifo.empty());
+		return true;
+	}
+
+	bool push(OutputChannel *channel, bool first)
 	{
 		if (first)
 		{
 			// It might be a good idea to not go back in time here.
 			// But that must be protected from wraparound.
-			_outputFIFO_current[index].micros = fastMicros() + _pollIntervalMicros;
+			channel->micros = fastMicros() + _pollIntervalMicros;
 		}
-		while (!_outputFIFO[index].full())
+		bool done = false;
+		uint16_t pushed = 0;
+		_writeChannel = channel;
+		while (!channel->fifo.full())
 		{
-			auto &w = _outputFIFO[index].writeRef();
+			++pushed;
+			auto &w = channel->fifo.writeRef();
 			_writeRef = &w;
-			uint16_t delta = _outputFIFO_current[index].task->SteppedTask_step();
+			uint16_t delta = channel->task->SteppedTask_step();
 			// The task should have called write now.
 
 			if (_writeRef)
 			{
 				// The task did not write.
 				w.pin = -1;
+				// Writes outside a step go directly to the pin, not to this pushed entry.
+				_writeRef = nullptr;
 			}
 			else
 			{
-				INS_ASSERT(w.pin == _outputFIFO_current[index].pin);
+				INS_ASSERT(w.pin == channel->pin);
 			}
-			w.micros = _outputFIFO_current[index].micros;
-			_outputFIFO[index].push();
+			w.micros = channel->micros;
+			channel->fifo.push();
 
 			if (delta == kInvalidDelta)
 			{
-				if (_outputFIFO_current[index].delegate)
-					_donelist.push_back(_outputFIFO_current[index]);
-				_outputFIFO_current[index].task = nullptr;
-				return true;
+				if (channel->delegate)
+					channel->done = channel->task;
+				channel->task = nullptr;
+				done = true;
+				break;
 			}
-			_outputFIFO_current[index].micros += delta;
+			channel->micros += channel->task->sleepMicros(delta);
 		}
-		return false;
+		// If only new writes are left the timer is not armed for them.
+		// Fire soon and let timerISR() find the earliest write.
+		if (_oneShot && pushed && channel->fifo.size() <= pushed)
+			armTimer(1);
+		return done;
 	}
 
 	void write(uint8_t pin, uint8_t state, uint8_t mode)
@@ -714,15 +1085,127 @@ private:
 		_writeRef->mode = mode;
 		_writeRef = nullptr;
 	}
+
+	void writeCarrier(uint8_t pin, uint8_t state, PinWriter *carrier)
+	{
+		if (!_writeRef)
+		{
+			carrier->write(state);
+			return;
+		}
+		INS_ASSERT(_writeChannel->carrier == carrier);
+		write(pin, state, kCarrierMode);
+	}
+
+	// Applies and pops the first write of channel.
+	INS_IRAM_ATTR void writeOutput(OutputChannel *channel)
+	{
+		auto &r = channel->fifo.readRef();
+		uint8_t pin = r.pin;
+		if (pin == (uint8_t)-1)
+		{
+			channel->fifo.pop();
+			return;
+		}
+		uint8_t state = r.state;
+		uint8_t mode = r.mode;
+#if INS_OUTPUT_STATISTICS
+		ins_smicros_t late = fastMicros() - r.micros;
+#endif
+		if (mode == kCarrierMode)
+		{
+			channel->carrier->write(state);
+		}
+		else if (mode == OUTPUT)
+		{
+			digitalWrite(pin, state);
+			digitalWrite(pin, state);
+			pinMode(pin, mode);
+		}
+		else
+		{
+			digitalWrite(pin, state);
+			pinMode(pin, OUTPUT);
+		}
+		channel->fifo.pop();
+#if INS_OUTPUT_STATISTICS
+		channel->statistics.add(late);
+		if (channel->task)
+		{
+			uint16_t left = channel->fifo.size();
+			if (left < channel->statistics.lowWater)
+				channel->statistics.lowWater = left;
+		}
+#endif
+	}
+
+	// Writes everything that is due and arms the timer for the earliest write left.
+	INS_IRAM_ATTR void oneShotTimerInterrupt()
+	{
+		ins_micros_t now = fastMicros();
+		bool pending = false;
+		ins_smicros_t next = 0;
+		for (OutputChannel *channel = _channels; channel; channel = channel->next)
+		{
+			while (!channel->fifo.empty())
+			{
+				auto &r = channel->fifo.readRef();
+				ins_smicros_t timeLeft = r.micros - now;
+				if (timeLeft > kOneShotMarginMicros)
+				{
+					if (!pending || timeLeft < next)
+						next = timeLeft;
+					pending = true;
+					break;
+				}
+				writeOutput(channel);
+			}
+		}
+		if (pending)
+			armTimer(next);
+	}
+
+	INS_IRAM_ATTR void timerInterrupt()
+	{
+		if (_oneShot)
+		{
+			oneShotTimerInterrupt();
+			return;
+		}
+		for (OutputChannel *channel = _channels; channel; channel = channel->next)
+		{
+			// Writes at the same time, like a stop followed by the start of the next task, are applied together.
+			while (!channel->fifo.empty())
+			{
+				ins_micros_t now = fastMicros();
+				auto &r = channel->fifo.readRef();
+				ins_micros_t targetMicros = r.micros;
+				ins_smicros_t timeLeft = targetMicros - now;
+				if (timeLeft > _pollIntervalMicros / 2)
+				{
+					break;
+				}
+				writeOutput(channel);
+			}
+		}
+	}
 };
 
+// The timer interrupt is defined here and not in the library so that it is built with the sketch's INS_ settings.
+INS_IRAM_ATTR inline void timerISR()
+{
+	InterruptWriteScheduler::instance()->timerInterrupt();
+}
+
 // offMode == OUTPUT -> push-pull.
 // offMode != OUTPUT -> pseudo open drain.
 // When offMode == OUTPUT onState is ignored.
+// Owns the output FIFO of pin, destroy it only when no writes are queued.
 // IMPORTANT: Encoders using this pin writer must be added to the InterruptWriteScheduler not the normal Scheduler!
 class InterruptPinWriter : public PinWriter
 {
 	InterruptWriteScheduler *_scheduler;
+	InterruptWriteScheduler::OutputChannel _channel;
 	uint8_t _pin;
 	uint8_t _onState;
 	uint8_t _offMode;
@@ -733,6 +1216,12 @@ public:
 		if (_offMode == OUTPUT)
 			digitalWrite(pin, onState ? 0 : 1);
 		pinMode(pin, _offMode);
+		_scheduler->attach(&_channel, pin, nullptr);
+	}
+
+	~InterruptPinWriter()
+	{
+		_scheduler->detach(&_channel);
 	}
 
 	void write(uint8_t value) override
@@ -744,6 +1233,47 @@ public:
 		}
 		_scheduler->write(_pin, value, _offMode);
 	}
+
+#if INS_OUTPUT_STATISTICS
+	const OutputStatistics &statistics() const { return _channel.statistics; }
+#endif
+};
+
+// Gates a carrier with writes timed by InterruptWriteScheduler.
+// Has the same limitations as PWMPinWriter, and prepare() must not be called while writes are queued.
+// Owns the output FIFO of pin, destroy it only when no writes are queued.
+// IMPORTANT: Encoders using this pin writer must be added to the InterruptWriteScheduler not the normal Scheduler!
+class InterruptPWMPinWriter : public PinWriter
+{
+	InterruptWriteScheduler *_scheduler;
+	PWMPinWriter _carrier;
+	InterruptWriteScheduler::OutputChannel _channel;
+	uint8_t _pin;
+public:
+	InterruptPWMPinWriter(InterruptWriteScheduler *scheduler, uint8_t pin, uint8_t onState) :
+		_scheduler(scheduler), _carrier(pin, onState), _pin(pin)
+	{
+		_scheduler->attach(&_channel, pin, &_carrier);
+	}
+
+	~InterruptPWMPinWriter()
+	{
+		_scheduler->detach(&_channel);
+	}
+
+	void prepare(uint32_t frequency, uint8_t dutyCycle)
+	{
+		_carrier.prepare(frequency, dutyCycle);
+	}
+
+	void write(uint8_t value) override
+	{
+		_scheduler->writeCarrier(_pin, value, &_carrier);
+	}
+
+#if INS_OUTPUT_STATISTICS
+	const OutputStatistics &statistics() const { return _channel.statistics; }
+#endif
 };
 #endif
 
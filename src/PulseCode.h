@@ -0,0 +1,320 @@
+// Copyright (c) 2024 Daniel Wallner
+
+#ifndef _INS_PULSE_CODE_H_
+#define _INS_PULSE_CODE_H_
+
+// Generic encoder and decoder for protocols where each bit is one mark and one space,
+// with optional header, repeat code and trailer mark.
+// A protocol is described by a struct derived from PulseCode that overrides the constants below.
+// Everything is resolved at compile time, unused parts of the code are removed.
+// See ProtocolNEC.h, ProtocolSIRC.h and ProtocolBeo36.h.
+
+#include "ProtocolUtils.h"
+#include "DebugUtils.h"
+
+namespace inseparates
+{
+
+struct PulseCode
+{
+	// What the bit value is decoded from.
+	enum Coding : uint8_t
+	{
+		kMarkWidth,
+		kSpaceWidth,
+		// Mark + space
+		kPeriod,
+	};
+
+	// Nominal widths in microseconds.
+
+	// Zero for no header.
+	static constexpr uint16_t kHeaderMark = 0;
+	static constexpr uint16_t kHeaderSpace = 0;
+	// Header space of a repeat code without data, zero if there is none.
+	static constexpr uint16_t kRepeatSpace = 0;
+	// Bits are sent LSB first.
+	static constexpr uint16_t kZeroMark = 0;
+	static constexpr uint16_t kZeroSpace = 0;
+	static constexpr uint16_t kOneMark = 0;
+	static constexpr uint16_t kOneSpace = 0;
+	// Mark after the last bit, zero for none.
+	static constexpr uint16_t kTrailerMark = 0;
+	// Start to start of repeated frames, or zero to use kTrailerSpace.
+	static constexpr uint32_t kRepeatPeriod = 0;
+	// Space after the last mark when kRepeatPeriod is zero.
+	static constexpr uint32_t kTrailerSpace = 0;
+	// Bits in a frame, the maximum if frames without trailer mark have variable length.
+	static constexpr uint8_t kBits = 32;
+	// Shortest frame without trailer mark that is delivered.
+	static constexpr uint8_t kMinBits = 1;
+
+	// Receive tolerances, inclusive.
+
+	static constexpr Coding kCoding = kPeriod;
+	static constexpr uint16_t kHeaderMarkMin = 0;
+	static constexpr uint16_t kHeaderMarkMax = 0;
+	static constexpr uint16_t kHeaderSpaceMin = 0;
+	static constexpr uint16_t kHeaderSpaceMax = 0;
+	// Header spaces from this and up that are not a header space are a repeat code.
+	static constexpr uint16_t kRepeatSpaceMin = 0;
+	// Pulses that do not carry the bit value: spaces with kMarkWidth, else marks.
+	static constexpr uint16_t kPulseMin = 0;
+	static constexpr uint16_t kPulseMax = 0;
+	// Pulses or periods that carry the bit value.
+	static constexpr uint16_t kZeroMin = 0;
+	static constexpr uint16_t kZeroMax = 0;
+	static constexpr uint16_t kOneMin = 0;
+	static constexpr uint16_t kOneMax = 0;
+	static constexpr uint16_t kTimeout = 0;
+};
+
+template<class P>
+class TxPulseCode : public SteppedTask
+{
+	static_assert(P::kRepeatPeriod || P::kTrailerSpace, "No repeat timing");
+	static_assert(!P::kRepeatSpace || (P::kHeaderMark && P::kTrailerMark), "Repeat code needs header and trailer");
+
+	static const uint8_t kFirstBit = P::kHeaderMark ? 2 : 0;
+
+	uint32_t _data;
+	PinWriter *_pin;
+	uint32_t _microsAccumulator;
+	uint8_t _mark;
+	uint8_t _bits;
+	uint8_t _count;
+	bool _sleepUntilRepeat;
+
+public:
+	TxPulseCode(PinWriter *pin, uint8_t mark) :
+		_pin(pin), _mark(mark), _count(-1)
+	{
+	}
+
+	// Zero bits sends a repeat code if the protocol has one.
+	void prepare(uint32_t data, uint8_t bits = P::kBits, bool sleepUntilRepeat = true)
+	{
+		INS_ASSERT(bits <= 32);
+		_data = data;
+		_bits = bits;
+		_count = -1;
+		_sleepUntilRepeat = sleepUntilRepeat;
+	}
+
+	uint16_t SteppedTask_step() override
+	{
+		++_count;
+		uint8_t last = kFirstBit + (_bits << 1) + (P::kTrailerMark ? 1 : -1);
+		if (_count > last)
+		{
+			_count = -1;
+			return SteppedTask::kInvalidDelta;
+		}
+		bool markPulse = !(_count & 1);
+		_pin->write(markPulse ? _mark : 1 ^ _mark);
+		if (_count == last)
+		{
+			return idleTimeLeft();
+		}
+		uint16_t width = pulseWidth();
+		_microsAccumulator = _count ? _microsAccumulator + width : width;
+		return width;
+	}
+
+private:
+	uint16_t pulseWidth()
+	{
+		if (P::kHeaderMark && _count < 2)
+		{
+			if (!_count)
+				return P::kHeaderMark;
+			return _bits || !P::kRepeatSpace ? P::kHeaderSpace : P::kRepeatSpace;
+		}
+		uint8_t index = _count - kFirstBit;
+		uint8_t bitNum = index >> 1;
+		if (bitNum >= _bits)
+			return P::kTrailerMark;
+		bool bitVal = (_data >> bitNum) & 1;
+		if (index & 1)
+			return bitVal ? P::kOneSpace : P::kZeroSpace;
+		return bitVal ? P::kOneMark : P::kZeroMark;
+	}
+
+	uint16_t idleTimeLeft()
+	{
+		if (!_sleepUntilRepeat)
+		{
+			_count = -1;
+			return SteppedTask::kInvalidDelta;
+		}
+		if (!P::kRepeatPeriod)
+		{
+			return longSleep(P::kTrailerSpace);
+		}
+		int32_t microsUntilRepeat = P::kRepeatPeriod - _microsAccumulator;
+		if (microsUntilRepeat <= 0)
+		{
+			_count = -1;
+			return SteppedTask::kInvalidDelta;
+		}
+		_microsAccumulator += microsUntilRepeat;
+		return longSleep(microsUntilRepeat);
+	}
+};
+
+template<class P>
+class RxPulseCode : public Decoder
+{
+	static_assert(P::kTrailerMark || P::kCoding == PulseCode::kMarkWidth, "The last bit must be terminated");
+	static_assert(P::kZeroMax < P::kOneMin || P::kOneMax < P::kZeroMin, "Overlapping bit tolerances");
+	static_assert(P::kTimeout, "No timeout");
+
+	static const uint8_t kFirstBit = P::kHeaderMark ? 2 : 0;
+
+	uint32_t _data;
+	uint16_t _markWidth;
+	uint8_t _mark;
+	uint8_t _count;
+	bool _repeat;
+
+protected:
+	uint8_t _bus;
+
+	// Called with the received bits, or with zero bits for a repeat code.
+	virtual void RxPulseCode_data(uint32_t data, uint8_t bits) = 0;
+
+public:
+	RxPulseCode(uint8_t mark, uint8_t bus) :
+		_mark(mark), _bus(bus)
+	{
+		reset();
+	}
+
+	void reset()
+	{
+		_data = 0;
+		_count = -1;
+		_repeat = false;
+	}
+
+	void Decoder_resync() override
+	{
+		reset();
+	}
+
+	void Decoder_timeout(uint8_t pinState) override
+	{
+		if (_count == uint8_t(-1))
+		{
+			INS_ASSERT(0);
+			return;
+		}
+
+		if (pinState != _mark)
+		{
+			if (_repeat)
+			{
+				RxPulseCode_data(0, 0);
+			}
+			else if (!P::kTrailerMark && _count >= kFirstBit)
+			{
+				// The last pulse was a mark.
+				uint8_t bits = ((_count - kFirstBit) >> 1) + 1;
+				if (bits >= P::kMinBits)
+					RxPulseCode_data(_data, bits);
+			}
+		}
+		reset();
+	}
+
+	uint16_t Decoder_pulse(uint8_t pulseState, uint16_t pulseWidth) override
+	{
+		bool mark = pulseState == _mark;
+		if (_count == uint8_t(-1))
+		{
+			if (!mark)
+			{
+				// Do not check for enough idle time here because pulseWidth can have wrapped.
+				return Decoder::kInvalidTimeout;
+			}
+			// First mark.
+		}
+
+		++_count;
+
+		if (P::kHeaderMark && _count < 2)
+		{
+			if (!_count)
+			{
+				if (!inRange(pulseWidth, P::kHeaderMarkMin, P::kHeaderMarkMax))
+					return invalid();
+				return P::kTimeout;
+			}
+			if (inRange(pulseWidth, P::kHeaderSpaceMin, P::kHeaderSpaceMax))
+				return P::kTimeout;
+			if (!P::kRepeatSpace || pulseWidth < P::kRepeatSpaceMin)
+				return invalid();
+			_repeat = true;
+			return P::kTimeout;
+		}
+
+		if (_repeat)
+		{
+			// Only the trailer mark follows.
+			if (!mark || !inRange(pulseWidth, P::kPulseMin, P::kPulseMax))
+				return invalid();
+			return P::kTimeout;
+		}
+
+		uint8_t bitNum = (_count - kFirstBit) >> 1;
+		if (mark)
+		{
+			if (P::kCoding == PulseCode::kMarkWidth)
+			{
+				if (bitNum >= P::kBits)
+					return invalid();
+				return decodeBit(pulseWidth, bitNum);
+			}
+			if (!inRange(pulseWidth, P::kPulseMin, P::kPulseMax))
+				return invalid();
+			if (P::kTrailerMark && bitNum == P::kBits)
+			{
+				RxPulseCode_data(_data, P::kBits);
+				reset();
+				return Decoder::kInvalidTimeout;
+			}
+			_markWidth = pulseWidth;
+			return P::kTimeout;
+		}
+
+		if (P::kCoding == PulseCode::kMarkWidth)
+		{
+			if (!inRange(pulseWidth, P::kPulseMin, P::kPulseMax))
+				return invalid();
+			return P::kTimeout;
+		}
+		return decodeBit(P::kCoding == PulseCode::kPeriod ? _markWidth + pulseWidth : pulseWidth, bitNum);
+	}
+
+private:
+	static inline bool inRange(uint16_t width, uint16_t min, uint16_t max) { return width >= min && width <= max; }
+
+	uint16_t invalid()
+	{
+		reset();
+		return Decoder::kInvalidTimeout;
+	}
+
+	uint16_t decodeBit(uint16_t width, uint8_t bitNum)
+	{
+		if (inRange(width, P::kOneMin, P::kOneMax))
+			_data |= uint32_t(1) << bitNum;
+		else if (!inRange(width, P::kZeroMin, P::kZeroMax))
+			return invalid();
+		return P::kTimeout;
+	}
+};
+
+}
+
+#endif
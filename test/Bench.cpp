@@ -0,0 +1,119 @@
+// Copyright (c) 2024 Daniel Wallner
+
+// Usage: bench_all [--filter=substring] [--min-time=seconds] [--json[=file]]
+// --json without file writes JSON to stdout instead of the table.
+
+#include "Bench.h"
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include <string>
+#include <vector>
+
+namespace
+{
+
+struct Bench
+{
+	std::string name;
+	std::string unit;
+	BenchFunction function;
+	uint64_t operations;
+	double seconds;
+};
+
+std::vector<Bench> &benches()
+{
+	static std::vector<Bench> s_benches;
+	return s_benches;
+}
+
+void writeJSON(FILE *f)
+{
+	fprintf(f, "{\n  \"benchmarks\": [");
+	bool first = true;
+	for (const Bench &bench : benches())
+	{
+		if (!bench.operations)
+			continue;
+		fprintf(f, "%s\n    { \"name\": \"%s\", \"unit\": \"%s\", \"operations\": %llu, \"seconds\": %.6f, \"ns_per_op\": %.3f, \"ops_per_second\": %.1f }",
+			first ? "" : ",",
+			bench.name.c_str(), bench.unit.c_str(), (unsigned long long)bench.operations, bench.seconds,
+			bench.seconds * 1e9 / bench.operations, bench.operations / bench.seconds);
+		first = false;
+	}
+	fprintf(f, "\n  ]\n}\n");
+}
+
+}
+
+void addBench(const char *name, const char *unit, BenchFunction function)
+{
+	benches().push_back(Bench { name, unit, function, 0, 0 });
+}
+
+int main(int argc, char **argv)
+{
+	const char *filter = nullptr;
+	const char *jsonFile = nullptr;
+	bool json = false;
+	double minSeconds = 0.2;
+	for (int i = 1; i < argc; ++i)
+	{
+		if (!strncmp(argv[i], "--filter=", 9))
+			filter = argv[i] + 9;
+		else if (!strncmp(argv[i], "--min-time=", 11))
+			minSeconds = atof(argv[i] + 11);
+		else if (!strcmp(argv[i], "--json"))
+			json = true;
+		else if (!strncmp(argv[i], "--json=", 7))
+			jsonFile = argv[i] + 7;
+		else
+		{
+			fprintf(stderr, "Usage: %s [--filter=substring] [--min-time=seconds] [--json[=file]]\n", argv[0]);
+			return 1;
+		}
+	}
+
+	addSchedulerBenches();
+	addProtocolBenches();
+
+	if (!json)
+		printf("%-56s %14s %16s\n", "benchmark", "ns/op", "op/s");
+	for (Bench &bench : benches())
+	{
+		if (filter && !strstr(bench.name.c_str(), filter))
+			continue;
+		BenchState state;
+		do
+		{
+			state.resume();
+			bench.operations += bench.function(state);
+			state.pause();
+		} while (state.seconds() < minSeconds);
+		bench.seconds = state.seconds();
+		if (!json)
+		{
+			std::string label = bench.name + " (" + bench.unit + ")";
+			printf("%-56s %14.1f %16.0f\n", label.c_str(), bench.seconds * 1e9 / bench.operations, bench.operations / bench.seconds);
+			fflush(stdout);
+		}
+	}
+
+	if (json)
+		writeJSON(stdout);
+	if (jsonFile)
+	{
+		FILE *f = fopen(jsonFile, "w");
+		if (!f)
+		{
+			fprintf(stderr, "Cannot write %s\n", jsonFile);
+			return 1;
+		}
+		writeJSON(f);
+		fclose(f);
+	}
+	return 0;
+}
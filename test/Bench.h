@@ -0,0 +1,48 @@
+// Copyright (c) 2024 Daniel Wallner
+
+// Minimal benchmark harness for bench_all.
+// Each benchmark function runs a batch of operations and returns how many it did.
+// It is called repeatedly until the minimum time has been measured.
+// Host timing is measured with the host clock while micros() is mocked.
+
+#ifndef _INS_BENCH_H_
+#define _INS_BENCH_H_
+
+#include <chrono>
+#include <functional>
+#include <stdint.h>
+
+class BenchState
+{
+	std::chrono::steady_clock::time_point _start;
+	std::chrono::steady_clock::duration _elapsed { 0 };
+	bool _running = false;
+public:
+	// Exclude setup from the measurement.
+	void pause()
+	{
+		if (!_running)
+			return;
+		_elapsed += std::chrono::steady_clock::now() - _start;
+		_running = false;
+	}
+	void resume()
+	{
+		if (_running)
+			return;
+		_start = std::chrono::steady_clock::now();
+		_running = true;
+	}
+	double seconds() const { return std::chrono::duration<double>(_elapsed).count(); }
+};
+
+typedef std::function<uint64_t(BenchState &state)> BenchFunction;
+
+// unit is what one operation is, e.g. "frame" or "poll".
+void addBench(const char *name, const char *unit, BenchFunction function);
+
+// Implemented in the respective Bench*.cpp.
+void addSchedulerBenches();
+void addProtocolBenches();
+
+#endif
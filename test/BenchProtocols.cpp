@@ -0,0 +1,328 @@
+// Copyright (c) 2024 Daniel Wallner
+
+// Encoder and decoder cost per frame for each protocol.
+// Encoders are stepped directly, without a scheduler, to a pin writer that only counts writes.
+// Decoders are fed a recorded frame with the timing the scheduler would use,
+// including Decoder_timeout() calls when an armed timeout expires before the next edge.
+// TechnicsSC has two pins and no Decoder. Its transmitter reads back the bus,
+// so pin reads and writes go to TechnicsSCBus and the receiver is fed through inputChanged().
+
+#include "Bench.h"
+
+#include "../src/ProtocolBeo36.h"
+#include "../src/ProtocolDatalink80.h"
+#include "../src/ProtocolDatalink86.h"
+#include "../src/ProtocolESI.h"
+#include "../src/ProtocolNEC.h"
+#include "../src/ProtocolRC5.h"
+#include "../src/ProtocolSIRC.h"
+#include "../src/ProtocolTechnicsSC.h"
+#include "../src/ProtocolUART.h"
+
+#include <stdio.h>
+
+#include <functional>
+#include <string>
+#include <vector>
+
+using namespace inseparates;
+
+namespace
+{
+
+const unsigned kFrames = 1000;
+
+class NullPinWriter : public PinWriter
+{
+public:
+	unsigned writes = 0;
+	void write(uint8_t /*value*/) override { ++writes; }
+};
+
+// Records level changes with the time accumulated from step deltas.
+class RecordingPinWriter : public PinWriter
+{
+public:
+	struct Edge
+	{
+		uint32_t time;
+		uint8_t level;
+	};
+
+	uint32_t time = 0;
+	uint8_t level;
+	std::vector<Edge> edges;
+
+	RecordingPinWriter(uint8_t idle) : level(idle) {}
+
+	void write(uint8_t value) override
+	{
+		if (value == level)
+			return;
+		level = value;
+		edges.push_back(Edge { time, value });
+	}
+};
+
+// Steps until the task stops and returns the total duration.
+uint32_t stepAll(SteppedTask &task)
+{
+	uint32_t duration = 0;
+	for (;;)
+	{
+		uint16_t delta = task.SteppedTask_step();
+		if (delta == SteppedTask::kInvalidDelta)
+			return duration;
+		duration += task.sleepMicros(delta);
+	}
+}
+
+uint32_t stepAll(SteppedTask &task, RecordingPinWriter &writer)
+{
+	for (;;)
+	{
+		uint16_t delta = task.SteppedTask_step();
+		if (delta == SteppedTask::kInvalidDelta)
+			return writer.time;
+		writer.time += task.sleepMicros(delta);
+	}
+}
+
+// Replays frames back to back, one every duration.
+class Replay
+{
+	std::vector<RecordingPinWriter::Edge> _edges;
+	uint32_t _duration;
+	uint8_t _idle;
+public:
+	Replay(const RecordingPinWriter &writer, uint32_t duration, uint8_t idle) :
+		_edges(writer.edges), _duration(duration), _idle(idle)
+	{
+	}
+
+	bool valid() const { return !_edges.empty() && _edges.back().level == _idle; }
+
+	void run(Decoder &decoder, unsigned frames)
+	{
+		uint8_t level = _idle;
+		uint32_t lastEdge = 0;
+		uint32_t frameStart = 0;
+		uint16_t timeout = Decoder::kInvalidTimeout;
+		bool timedOut = true;
+		for (unsigned f = 0; f < frames; ++f, frameStart += _duration)
+		{
+			for (const RecordingPinWriter::Edge &edge : _edges)
+			{
+				uint32_t time = frameStart + edge.time;
+				uint32_t width = time - lastEdge;
+				if (timeout != Decoder::kInvalidTimeout && width > timeout)
+				{
+					decoder.Decoder_timeout(level);
+					timedOut = true;
+				}
+				if (timedOut)
+					width = 0;
+				else if (width > 0xFFFF)
+					width = 0xFFFF;
+				timeout = decoder.Decoder_pulse(level, width ? width : 1);
+				timedOut = false;
+				level = edge.level;
+				lastEdge = time;
+			}
+		}
+		if (timeout != Decoder::kInvalidTimeout)
+			decoder.Decoder_timeout(level);
+	}
+};
+
+class Received :
+	public RxRC5::Delegate,
+	public RxNEC::Delegate,
+	public RxSIRC::Delegate,
+	public RxESI::Delegate,
+	public RxBeo36::Delegate,
+	public RxDatalink80::Delegate,
+	public RxDatalink86::Delegate,
+	public RxUART::Delegate,
+	public RxTechnicsSC::Delegate
+{
+public:
+	unsigned count = 0;
+	unsigned errors = 0;
+
+	void RxRC5Delegate_data(uint16_t /*data*/, uint8_t /*bus*/) override { ++count; }
+	void RxNECDelegate_data(uint32_t /*data*/, uint8_t /*bus*/) override { ++count; }
+	void RxSIRCDelegate_data(uint32_t /*data*/, uint8_t /*bits*/, uint8_t /*bus*/) override { ++count; }
+	void RxESIDelegate_data(uint64_t /*data*/, uint8_t /*bits*/, uint8_t /*bus*/) override { ++count; }
+	void RxBeo36Delegate_data(uint8_t /*data*/, uint8_t /*bus*/) override { ++count; }
+	void RxDatalink80Delegate_data(uint8_t /*data*/, uint8_t /*bus*/) override { ++count; }
+	void RxDatalink80Delegate_timingError() override { ++errors; }
+	void RxDatalink86Delegate_data(uint64_t /*data*/, uint8_t /*bits*/, uint8_t /*bus*/) override { ++count; }
+	void RxUARTDelegate_data(uint8_t /*data*/, uint8_t /*bus*/) override { ++count; }
+	void RxUARTDelegate_timingError(uint8_t /*bus*/) override { ++errors; }
+	void RxUARTDelegate_parityError(uint8_t /*bus*/) override { ++errors; }
+	void RxTechnicsSCDelegate_data(uint32_t /*data*/) override { ++count; }
+};
+
+// Data and clock pins where reads return the last written level, with time from step deltas.
+// Clock edges are recorded with the data state, as RxTechnicsSC::inputChanged() takes them.
+class TechnicsSCBus : public DummyHooks
+{
+public:
+	static const uint8_t kDataPin = 0;
+	static const uint8_t kClockPin = 1;
+	static const uint8_t kMark = HIGH;
+
+	struct Edge
+	{
+		uint32_t time;
+		bool dataState;
+		bool clockState;
+	};
+
+	uint32_t time = 0;
+	uint8_t levels[2] = { kMark, 1 ^ kMark };
+	bool record = false;
+	std::vector<Edge> edges;
+
+	TechnicsSCBus() { g_dummyHooks = this; }
+	~TechnicsSCBus() { g_dummyHooks = nullptr; }
+
+	// Steps until the frame is sent, including the wait for a quiet bus.
+	void send(TxTechnicsSC &tx, uint32_t data)
+	{
+		tx.prepare(data);
+		do
+		{
+			time += tx.sleepMicros(tx.SteppedTask_step());
+		} while (!tx.done());
+	}
+
+	uint32_t DummyHooks_micros() override { return time; }
+	void DummyHooks_delayMicroseconds(unsigned int us) override { time += us; }
+	void DummyHooks_pinMode(uint8_t /*pin*/, uint8_t /*mode*/) override {}
+	int DummyHooks_digitalRead(uint8_t pin) override { return levels[pin]; }
+	void DummyHooks_digitalWrite(uint8_t pin, uint8_t value) override
+	{
+		bool clockEdge = pin == kClockPin && levels[pin] != value;
+		levels[pin] = value;
+		if (record && clockEdge)
+			edges.push_back(Edge { time, levels[kDataPin] == kMark, levels[kClockPin] == kMark });
+	}
+};
+
+void addTechnicsSC()
+{
+	addBench("encode/technics_sc", "frame", [](BenchState &state)
+	{
+		state.pause();
+		TechnicsSCBus bus;
+		PushPullPinWriter dataPinWriter(TechnicsSCBus::kDataPin);
+		PushPullPinWriter clockPinWriter(TechnicsSCBus::kClockPin);
+		TxTechnicsSC tx(&dataPinWriter, &clockPinWriter, TechnicsSCBus::kDataPin, TechnicsSCBus::kClockPin, TechnicsSCBus::kMark);
+		state.resume();
+		for (unsigned f = 0; f < kFrames; ++f)
+		{
+			bus.send(tx, TxTechnicsSC::encodeIR(0x0A, f & 0xFF));
+		}
+		return uint64_t(kFrames);
+	});
+
+	addBench("decode/technics_sc", "frame", [](BenchState &state)
+	{
+		state.pause();
+		std::vector<TechnicsSCBus::Edge> edges;
+		{
+			TechnicsSCBus bus;
+			PushPullPinWriter dataPinWriter(TechnicsSCBus::kDataPin);
+			PushPullPinWriter clockPinWriter(TechnicsSCBus::kClockPin);
+			TxTechnicsSC tx(&dataPinWriter, &clockPinWriter, TechnicsSCBus::kDataPin, TechnicsSCBus::kClockPin, TechnicsSCBus::kMark);
+			bus.record = true;
+			bus.send(tx, TxTechnicsSC::encodeIR(0x0A, 0x20));
+			edges = bus.edges;
+		}
+		Received received;
+		RxTechnicsSC rx(TechnicsSCBus::kDataPin, TechnicsSCBus::kClockPin, TechnicsSCBus::kMark, &received);
+		state.resume();
+
+		for (unsigned f = 0; f < kFrames; ++f)
+		{
+			uint32_t lastEdge = edges.front().time;
+			for (const TechnicsSCBus::Edge &edge : edges)
+			{
+				rx.inputChanged(edge.dataState, edge.clockState, edge.time - lastEdge);
+				lastEdge = edge.time;
+			}
+		}
+
+		state.pause();
+		if (received.count != kFrames)
+			fprintf(stderr, "technics_sc: %u of %u frames decoded!\n", received.count, kFrames);
+		return uint64_t(kFrames);
+	});
+}
+
+// prepare(tx, frame) prepares a frame, setup(rx) configures the receiver if needed.
+template <class Tx, class Rx>
+void addProtocol(const char *name, uint8_t mark, uint8_t idle, std::function<void(Tx &tx, unsigned frame)> prepare, std::function<void(Rx &rx)> setup = nullptr)
+{
+	std::string encodeName = std::string("encode/") + name;
+	addBench(encodeName.c_str(), "frame", [mark, prepare](BenchState &state)
+	{
+		NullPinWriter writer;
+		Tx tx(&writer, mark);
+		uint32_t duration = 0;
+		for (unsigned f = 0; f < kFrames; ++f)
+		{
+			prepare(tx, f);
+			duration += stepAll(tx);
+		}
+		state.pause();
+		if (!writer.writes || !duration)
+			fprintf(stderr, "Nothing was sent!\n");
+		return uint64_t(kFrames);
+	});
+
+	std::string decodeName = std::string("decode/") + name;
+	addBench(decodeName.c_str(), "frame", [name, mark, idle, prepare, setup](BenchState &state)
+	{
+		state.pause();
+		RecordingPinWriter writer(idle);
+		Tx tx(&writer, mark);
+		prepare(tx, 0);
+		uint32_t duration = stepAll(tx, writer);
+		Replay replay(writer, duration, idle);
+		Received received;
+		Rx rx(mark, &received);
+		if (setup)
+			setup(rx);
+		state.resume();
+
+		replay.run(rx, kFrames);
+
+		state.pause();
+		if (!replay.valid() || received.count < kFrames - 1 || received.errors)
+			fprintf(stderr, "%s: %u of %u frames decoded, %u errors!\n", name, received.count, kFrames, received.errors);
+		return uint64_t(kFrames);
+	});
+}
+
+}
+
+void addProtocolBenches()
+{
+	addProtocol<TxRC5, RxRC5>("rc5", HIGH, LOW, [](TxRC5 &tx, unsigned f) { tx.prepare(TxRC5::encodeRC5(f & 1, 0x05, f & 0x3F)); });
+	addProtocol<TxNEC, RxNEC>("nec", HIGH, LOW, [](TxNEC &tx, unsigned f) { tx.prepare(TxNEC::encodeNEC(0x59, f & 0xFF)); });
+	addProtocol<TxSIRC, RxSIRC>("sirc12", HIGH, LOW, [](TxSIRC &tx, unsigned f) { tx.prepare(TxSIRC::encodeSIRC(0x01, f & 0x7F), 12); });
+	addProtocol<TxESI, RxESI>("esi", HIGH, LOW, [](TxESI &tx, unsigned f) { tx.prepare(0x5555555 ^ f, 28); });
+	addProtocol<TxBeo36, RxBeo36>("beo36", HIGH, LOW, [](TxBeo36 &tx, unsigned f) { tx.prepare(f & 0x3F); });
+	addProtocol<TxDatalink80, RxDatalink80>("datalink80", LOW, HIGH, [](TxDatalink80 &tx, unsigned f) { tx.prepare(f & 0x7F); });
+	addProtocol<TxDatalink86, RxDatalink86>("datalink86", LOW, HIGH, [](TxDatalink86 &tx, unsigned f) { tx.prepare(0x083E35 ^ (f & 0xFF), 21, false, false); });
+	addProtocol<TxUART, RxUART>("uart_115200_8n1", HIGH, HIGH, [](TxUART &tx, unsigned f)
+	{
+		tx.setBaudrate(115200);
+		tx.prepare(f);
+	},
+	[](RxUART &rx) { rx.setBaudrate(115200); });
+	addTechnicsSC();
+}
@@ -0,0 +1,375 @@
+// Copyright (c) 2024 Daniel Wallner
+
+// Scheduler::poll() and input dispatch cost.
+
+#include "Bench.h"
+
+#include "../src/ProtocolBeo36.h"
+#include "../src/ProtocolNEC.h"
+#include "../src/ProtocolRC5.h"
+#include "../src/ProtocolSIRC.h"
+#include "../src/ProtocolTechnicsSC.h"
+#include "Simulator.h"
+
+#include <stdio.h>
+
+#include <string>
+
+using namespace inseparates;
+
+namespace
+{
+
+// Sleeps the maximum time, will never be due during the benchmark as mocked time does not advance.
+class SleepingTask : public SteppedTask
+{
+public:
+	uint16_t SteppedTask_step() override { return kMaxSleepMicros; }
+};
+
+// Due on every poll.
+class BusyTask : public SteppedTask
+{
+public:
+	unsigned steps = 0;
+	uint16_t SteppedTask_step() override { ++steps; return 0; }
+};
+
+// Counts pulses, never arms a timeout.
+class CountingDecoder : public Decoder
+{
+public:
+	unsigned pulses = 0;
+	uint16_t Decoder_pulse(uint8_t /*pulseState*/, uint16_t /*pulseWidth*/) override { ++pulses; return kInvalidTimeout; }
+	void Decoder_timeout(uint8_t /*pinState*/) override {}
+};
+
+const unsigned kPolls = 100000;
+const uint8_t kFirstPin = 2;
+
+// One busy task and numTasks - 1 sleeping tasks.
+uint64_t benchPollTasks(BenchState &state, unsigned numTasks)
+{
+	state.pause();
+	Scheduler scheduler;
+	SleepingTask sleeping[INS_SEQUENCER_MAX_NUM_TASKS];
+	BusyTask busy;
+	scheduler.add(&busy);
+	for (unsigned i = 1; i < numTasks; ++i)
+	{
+		scheduler.add(&sleeping[i]);
+	}
+	state.resume();
+
+	for (unsigned i = 0; i < kPolls; ++i)
+	{
+		scheduler.poll();
+	}
+
+	state.pause();
+	if (busy.steps < kPolls)
+		fprintf(stderr, "Busy task was not stepped on every poll!\n");
+	return kPolls;
+}
+
+// Sleeping tasks and idle interrupt driven decoders, the common case when nothing happens.
+uint64_t benchPollIdle(BenchState &state, unsigned count)
+{
+	state.pause();
+	Scheduler scheduler;
+	SleepingTask sleeping[INS_SEQUENCER_MAX_NUM_TASKS];
+	CountingDecoder decoders[INS_SEQUENCER_MAX_NUM_INPUTS];
+	for (unsigned i = 0; i < count; ++i)
+	{
+		scheduler.add(&sleeping[i]);
+		digitalWrite(kFirstPin + i, LOW);
+		scheduler.add(&decoders[i], kFirstPin + i, true);
+	}
+	state.resume();
+
+	for (unsigned i = 0; i < kPolls; ++i)
+	{
+		scheduler.poll();
+	}
+
+	state.pause();
+	for (unsigned i = 0; i < count; ++i)
+	{
+		scheduler.remove(&decoders[i]);
+	}
+	return kPolls;
+}
+
+// Polled decoders, toggling every pin between polls when changing.
+// Compare builds with and without INS_PORT_SAMPLING.
+uint64_t benchPolledInputs(BenchState &state, unsigned numPins, bool changing)
+{
+	state.pause();
+	Scheduler scheduler;
+	CountingDecoder decoders[INS_SEQUENCER_MAX_NUM_INPUTS];
+	for (unsigned i = 0; i < numPins; ++i)
+	{
+		digitalWrite(kFirstPin + i, LOW);
+		scheduler.add(&decoders[i], kFirstPin + i);
+	}
+
+	const unsigned kRounds = changing ? 2000 : kPolls;
+	for (unsigned r = 0; r < kRounds; ++r)
+	{
+		if (changing)
+		{
+			resetLogs();
+			for (unsigned i = 0; i < numPins; ++i)
+			{
+				digitalWrite(kFirstPin + i, !g_pinStates[kFirstPin + i]);
+			}
+		}
+		state.resume();
+		scheduler.poll();
+		state.pause();
+	}
+
+	for (unsigned i = 0; i < numPins; ++i)
+	{
+		scheduler.remove(&decoders[i]);
+	}
+	return kRounds;
+}
+
+// Edges are queued by toggling interrupt pins between polls, only poll() is measured.
+uint64_t benchDispatch(BenchState &state, unsigned numPins, unsigned edgesPerPoll)
+{
+	const unsigned kRounds = 2000;
+	state.pause();
+	Scheduler scheduler;
+	CountingDecoder decoders[INS_SEQUENCER_MAX_NUM_INPUTS];
+	for (unsigned i = 0; i < numPins; ++i)
+	{
+		digitalWrite(kFirstPin + i, LOW);
+		scheduler.add(&decoders[i], kFirstPin + i, true);
+	}
+
+	unsigned edges = 0;
+	for (unsigned r = 0; r < kRounds; ++r)
+	{
+		resetLogs();
+		for (unsigned e = 0; e < edgesPerPoll; ++e)
+		{
+			uint8_t pin = kFirstPin + e % numPins;
+			digitalWrite(pin, !g_pinStates[pin]);
+		}
+		delayMicroseconds(1);
+		state.resume();
+		scheduler.poll();
+		state.pause();
+		edges += edgesPerPoll;
+	}
+
+	unsigned pulses = 0;
+	for (unsigned i = 0; i < numPins; ++i)
+	{
+		pulses += decoders[i].pulses;
+		scheduler.remove(&decoders[i]);
+	}
+	if (pulses != edges)
+		fprintf(stderr, "Dispatched %u of %u edges!\n", pulses, edges);
+	return edges;
+}
+
+// RC-5 frames sent back to back from a TxRC5 to an interrupt driven RxRC5 over a simulated wire.
+uint64_t benchSimulatedRC5(BenchState &state)
+{
+	class Loop : public Scheduler::Delegate, public RxRC5::Delegate
+	{
+		Scheduler &_scheduler;
+		TxRC5 &_tx;
+	public:
+		unsigned sent = 0;
+		unsigned received = 0;
+
+		Loop(Scheduler &scheduler, TxRC5 &tx) : _scheduler(scheduler), _tx(tx) {}
+
+		void send()
+		{
+			_tx.prepare(TxRC5::encodeRC5(sent & 1, 0x05, sent & 0x3F), false);
+			_scheduler.add(&_tx, this);
+			++sent;
+		}
+
+		void SchedulerDelegate_done(SteppedTask */*task*/) override { send(); }
+		void RxRC5Delegate_data(uint16_t /*data*/, uint8_t /*bus*/) override { ++received; }
+	};
+
+	const unsigned kFrames = 1000;
+	state.pause();
+	Simulator simulator;
+	uint8_t wire = simulator.addWire({ 2, 3 });
+	simulator.setJitter(wire, 20);
+	simulator.setInterruptLatency(2, 10);
+
+	Scheduler scheduler;
+	PushPullPinWriter pinWriter(2);
+	TxRC5 tx(&pinWriter, HIGH);
+	Loop loop(scheduler, tx);
+	RxRC5 rx(HIGH, &loop);
+	scheduler.add(&rx, 3, true);
+	loop.send();
+	state.resume();
+
+	simulator.runUntil(scheduler, [&]() { return loop.received >= kFrames; }, uint64_t(kFrames) * 100000);
+
+	state.pause();
+	if (loop.received < kFrames)
+		fprintf(stderr, "Received %u of %u RC-5 frames!\n", loop.received, kFrames);
+	scheduler.remove(&rx);
+	return loop.received;
+}
+
+// Technics System Control frames between a TxTechnicsSC and a polled RxTechnicsSC on the same pins.
+uint64_t benchSimulatedTechnicsSC(BenchState &state)
+{
+	class Loop : public TxTechnicsSC::Delegate, public RxTechnicsSC::Delegate
+	{
+	public:
+		TxTechnicsSC *tx = nullptr;
+		unsigned sent = 0;
+		unsigned received = 0;
+
+		void send()
+		{
+			tx->prepare(TxTechnicsSC::encodeIR(0x0A, sent & 0xFF));
+			++sent;
+		}
+
+		void TxTechnicsSCDelegate_done() override { send(); }
+		void RxTechnicsSCDelegate_data(uint32_t /*data*/) override { ++received; }
+	};
+
+	const unsigned kFrames = 100;
+	const uint8_t kDataPin = 3;
+	const uint8_t kClockPin = 4;
+	state.pause();
+	Simulator simulator;
+	Scheduler scheduler;
+	Loop loop;
+	PushPullPinWriter dataPinWriter(kDataPin);
+	PushPullPinWriter clockPinWriter(kClockPin);
+	TxTechnicsSC tx(&dataPinWriter, &clockPinWriter, kDataPin, kClockPin, HIGH, &loop);
+	RxTechnicsSC rx(kDataPin, kClockPin, HIGH, &loop);
+	loop.tx = &tx;
+	scheduler.add(&rx);
+	scheduler.add(&tx);
+	loop.send();
+	state.resume();
+
+	simulator.runUntil(scheduler, [&]() { return loop.received >= kFrames; }, uint64_t(kFrames) * 100000);
+
+	state.pause();
+	if (loop.received < kFrames)
+		fprintf(stderr, "Received %u of %u Technics SC frames!\n", loop.received, kFrames);
+	return loop.received;
+}
+
+
+// NEC frames sent back to back to four IR decoders sharing one interrupt pin.
+// Compare with and without Scheduler::classify().
+uint64_t benchSharedPin(BenchState &state, bool classify)
+{
+	class Loop : public Scheduler::Delegate, public RxNEC::Delegate, public RxSIRC::Delegate, public RxBeo36::Delegate, public RxRC5::Delegate
+	{
+		Scheduler &_scheduler;
+		TxNEC &_tx;
+	public:
+		unsigned sent = 0;
+		unsigned received = 0;
+
+		Loop(Scheduler &scheduler, TxNEC &tx) : _scheduler(scheduler), _tx(tx) {}
+
+		void send()
+		{
+			_tx.prepare(TxNEC::encodeNEC(0x59, sent & 0xFF));
+			_scheduler.add(&_tx, this);
+			++sent;
+		}
+
+		void SchedulerDelegate_done(SteppedTask */*task*/) override { send(); }
+		void RxNECDelegate_data(uint32_t /*data*/, uint8_t /*bus*/) override { ++received; }
+		void RxSIRCDelegate_data(uint32_t /*data*/, uint8_t /*bits*/, uint8_t /*bus*/) override {}
+		void RxBeo36Delegate_data(uint8_t /*data*/, uint8_t /*bus*/) override {}
+		void RxRC5Delegate_data(uint16_t /*data*/, uint8_t /*bus*/) override {}
+	};
+
+	const unsigned kFrames = 1000;
+	state.pause();
+	Simulator simulator;
+	uint8_t wire = simulator.addWire({ 2, 3 });
+	simulator.setJitter(wire, 20);
+	simulator.setInterruptLatency(2, 10);
+
+	Scheduler scheduler;
+	PushPullPinWriter pinWriter(2);
+	TxNEC tx(&pinWriter, HIGH);
+	Loop loop(scheduler, tx);
+	RxNEC rxNEC(HIGH, &loop);
+	RxSIRC rxSIRC(HIGH, &loop);
+	RxBeo36 rxBeo36(HIGH, &loop);
+	RxRC5 rxRC5(HIGH, &loop);
+	scheduler.add(&rxNEC, 3, true);
+	scheduler.add(&rxSIRC, 3, true);
+	scheduler.add(&rxBeo36, 3, true);
+	scheduler.add(&rxRC5, 3, true);
+	scheduler.classify(3, classify);
+	loop.send();
+	state.resume();
+
+	simulator.runUntil(scheduler, [&]() { return loop.received >= kFrames; }, uint64_t(kFrames) * 120000);
+
+	state.pause();
+	if (loop.received < kFrames)
+		fprintf(stderr, "Received %u of %u NEC frames!\n", loop.received, kFrames);
+	return loop.received;
+}
+
+}
+
+void addSchedulerBenches()
+{
+	const unsigned kTasks[] = { 1, 4, INS_SEQUENCER_MAX_NUM_TASKS };
+	for (unsigned numTasks : kTasks)
+	{
+		std::string name = "scheduler/poll/busy_task+" + std::to_string(numTasks - 1) + "_sleeping";
+		addBench(name.c_str(), "poll", [numTasks](BenchState &state) { return benchPollTasks(state, numTasks); });
+	}
+
+	const unsigned kIdle[] = { 0, 4, INS_SEQUENCER_MAX_NUM_INPUTS };
+	for (unsigned count : kIdle)
+	{
+		std::string name = "scheduler/poll/idle_" + std::to_string(count) + "_tasks_" + std::to_string(count) + "_decoders";
+		addBench(name.c_str(), "poll", [count](BenchState &state) { return benchPollIdle(state, count); });
+	}
+
+	const unsigned kPolled[] = { 1, 4, INS_SEQUENCER_MAX_NUM_INPUTS };
+	for (unsigned numPins : kPolled)
+	{
+		std::string name = "scheduler/poll/" + std::to_string(numPins) + "_polled_pins";
+		addBench(name.c_str(), "poll", [numPins](BenchState &state) { return benchPolledInputs(state, numPins, false); });
+		name += "_changing";
+		addBench(name.c_str(), "poll", [numPins](BenchState &state) { return benchPolledInputs(state, numPins, true); });
+	}
+
+	const unsigned kPins[] = { 1, 2, 4 };
+	const unsigned kEdgesPerPoll[] = { 1, 16, 128 };
+	for (unsigned numPins : kPins)
+	{
+		for (unsigned edgesPerPoll : kEdgesPerPoll)
+		{
+			std::string name = "scheduler/dispatch/" + std::to_string(numPins) + "_pins_" + std::to_string(edgesPerPoll) + "_edges_per_poll";
+			addBench(name.c_str(), "edge", [numPins, edgesPerPoll](BenchState &state) { return benchDispatch(state, numPins, edgesPerPoll); });
+		}
+	}
+
+	addBench("simulator/rc5_loopback", "frame", benchSimulatedRC5);
+	addBench("simulator/technics_sc_loopback", "frame", benchSimulatedTechnicsSC);
+	addBench("simulator/shared_pin_4_decoders", "frame", [](BenchState &state) { return benchSharedPin(state, false); });
+	addBench("simulator/shared_pin_4_decoders_classified", "frame", [](BenchState &state) { return benchSharedPin(state, true); });
+}
@@ -297,7 +297,7 @@ int main()
 			}
 		};
 
-		uint16_t esiStartDelay = 4321;
+		uint32_t esiStartDelay = 4321;
 
 		Delegate delegate;
 
@@ -389,7 +389,7 @@ int main()
 
 		RxNEC necDecoder(LOW, &delegate);
 
-		uint16_t necStartDelay = 12345;
+		uint32_t necStartDelay = 12345;
 		uint8_t pin = 7;
 
 		uint32_t data = TxNEC::encodeNEC(0, 0);
@@ -18,41 +18,91 @@
 #include <thread>
 #include <vector>
 #include <atomic>
+#include <chrono>
 
 using namespace inseparates;
 
-#define FIFO_SIZE 8
+#define FIFO_TEST_ITEMS 0x3FFFFF
 
-#define FIFO_TEST_ITEMS 0x2FFFFFF
-
-void push_to_fifo(LockFreeFIFO<unsigned, FIFO_SIZE>& fifo, unsigned num_items)
+template<size_t N>
+void push_to_fifo(LockFreeFIFO<unsigned, N>& fifo, unsigned num_items, unsigned batch)
 {
-    for (unsigned i = 0; i < num_items; ++i)
+    for (unsigned i = 0; i < num_items;)
     {
-        while (fifo.full());
-        fifo.writeRef() = i;
-        fifo.push();
+        unsigned count = fifo.freeSpace();
+        if (!count)
+        {
+            // Spinning without yielding is very slow on single core hosts.
+            std::this_thread::yield();
+            continue;
+        }
+        if (count > batch)
+            count = batch;
+        if (count > num_items - i)
+            count = num_items - i;
+        for (unsigned j = 0; j < count; ++j)
+            fifo.writeRef(j) = i + j;
+        fifo.push(count);
+        i += count;
     }
 }
 
-int main()
+// Batch size 1 exercises the single entry functions in the consumer.
+template<size_t N>
+void test_fifo(unsigned batch)
 {
-    {
-        LockFreeFIFO<unsigned, FIFO_SIZE> fifo;
+    LockFreeFIFO<unsigned, N> fifo;
 
-        std::thread push_thread(push_to_fifo, std::ref(fifo), FIFO_TEST_ITEMS);
+    auto start = std::chrono::steady_clock::now();
 
-        for (unsigned i = 0; i < FIFO_TEST_ITEMS; ++i)
+    std::thread push_thread(push_to_fifo<N>, std::ref(fifo), FIFO_TEST_ITEMS, batch);
+
+    for (unsigned i = 0; i < FIFO_TEST_ITEMS;)
+    {
+        if (batch == 1)
         {
-            while (fifo.empty());
+            while (fifo.empty())
+                std::this_thread::yield();
             unsigned item = fifo.readRef();
             fifo.pop();
             assert(item == i);
+            ++i;
+            continue;
         }
-
-        push_thread.join();
+        unsigned count = fifo.size();
+        if (!count)
+        {
+            std::this_thread::yield();
+            continue;
+        }
+        assert(count < N);
+        for (unsigned j = 0; j < count; ++j)
+        {
+            unsigned item = fifo.readRef(j);
+            assert(item == i + j);
+        }
+        fifo.pop(count);
+        i += count;
     }
 
+    push_thread.join();
+
+    assert(fifo.empty());
+
+    double seconds = std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count();
+    printf("LockFreeFIFO<%5u> batch %3u: %6.1f Mitems/s\n", unsigned(N), batch, FIFO_TEST_ITEMS / seconds / 1e6);
+}
+
+int main()
+{
+    test_fifo<8>(1);
+    test_fifo<8>(8);
+    test_fifo<256>(1);
+    test_fifo<256>(64);
+    test_fifo<1024>(1);
+    test_fifo<1024>(64);
+    test_fifo<4096>(256);
+
     {
         resetLogs();
 
@@ -124,7 +124,7 @@ int main()
 		RxUART rxUART(HIGH, &delegate, kBus);
 		rxUART.setBaudrate(10000);
 
-		uint16_t startDelay = 4321;
+		uint32_t startDelay = 4321;
 		uint8_t data = 0x81;
 		resetLogs();
 		PushPullPinWriter pinWriter(pin);
@@ -139,7 +139,7 @@ int main()
 		}
 		rxUART.Decoder_timeout(g_digitalWriteStateLog[pin].back());
 		assert(1000 + startDelay ==  totalDelay());
-		assert(data = delegate.receivedData.back());
+		assert(data == delegate.receivedData.back());
 
 		rxUART.setFormat(Parity::kOdd, 5);
 		tx1.setFormat(Parity::kOdd, 5, 6);
@@ -16,8 +16,15 @@ std::map<uint8_t, std::vector<uint8_t>> g_digitalWriteStateLog;
 std::map<uint8_t, std::vector<uint32_t>> g_digitalWriteTimeLog;
 std::map<uint8_t, uint8_t> g_pinStates;
 std::map<uint8_t, uint32_t> g_lastWrite;
+std::map<uint8_t, std::vector<unsigned>> g_toneLog;
+std::map<uint8_t, std::vector<uint32_t>> g_toneTimeLog;
 std::map<uint8_t, std::function<void(void)>> g_pinInterrupts;
+DummyHooks *g_dummyHooks;
+volatile uint32_t g_portInputRegisters[32];
 std::vector<IntervalInterrupt> g_intervalInterrupts;
+void (*g_oneShotISR)(void);
+uint32_t g_oneShotTime;
+unsigned g_timerInterrupts;
 #if 1
 // For wraparound debugging.
 const uint32_t kStartTime = 0xFFFFC000;
@@ -28,37 +35,41 @@ const uint32_t kStartTime = 0;
 
 void delayMicroseconds(unsigned int us)
 {
+	if (g_dummyHooks)
+		return g_dummyHooks->DummyHooks_delayMicroseconds(us);
 	if (g_delayMicrosecondsLog.size())
 		g_delayMicrosecondsLog.push_back(g_delayMicrosecondsLog.back() + us);
 	else
 		g_delayMicrosecondsLog.push_back(kStartTime + us);
 	uint32_t backValue = g_delayMicrosecondsLog.back();
-	for (size_t i = 0; i < g_intervalInterrupts.size(); ++i)
+	uint32_t time;
+	while (nextTimerInterrupt(time) && int32_t(time - backValue) <= 0)
 	{
-		IntervalInterrupt &interrupt = g_intervalInterrupts.back();
-		while(interrupt.t + interrupt.interval <= backValue)
-		{
-			interrupt.t += interrupt.interval;
-			g_delayMicrosecondsLog.back() = interrupt.t;
-			interrupt.isr();
-		}
+		g_delayMicrosecondsLog.back() = time;
+		runTimerInterrupt();
 	}
 	g_delayMicrosecondsLog.back() = backValue;
 }
 
 uint32_t micros()
 {
+	if (g_dummyHooks)
+		return g_dummyHooks->DummyHooks_micros();
 	if (!g_delayMicrosecondsLog.size())
 		return kStartTime;
 	return g_delayMicrosecondsLog.back();
 }
 
-void pinMode(uint8_t /*pin*/, uint8_t /*mode*/)
+void pinMode(uint8_t pin, uint8_t mode)
 {
+	if (g_dummyHooks)
+		g_dummyHooks->DummyHooks_pinMode(pin, mode);
 }
 
 int digitalRead(uint8_t pin)
 {
+	if (g_dummyHooks)
+		return g_dummyHooks->DummyHooks_digitalRead(pin);
 	return g_pinStates[pin];
 }
 
@@ -66,8 +77,11 @@ int digitalRead(uint8_t pin)
 void digitalWrite(uint8_t pin, uint8_t value)
 {
 	assert(value < 2);
+	if (g_dummyHooks)
+		return g_dummyHooks->DummyHooks_digitalWrite(pin, value);
 	bool change = g_pinStates[pin] != value;
 	g_pinStates[pin] = value;
+	setPortInput(pin, value);
 	g_digitalWriteStateLog[pin].push_back(value);
 	if (g_digitalWriteTimeLog[pin].size())
 	{
@@ -89,6 +103,26 @@ void resetLogs()
 	g_delayMicrosecondsLog.clear();
 	g_digitalWriteStateLog.clear();
 	g_digitalWriteTimeLog.clear();
+	g_toneLog.clear();
+	g_toneTimeLog.clear();
+}
+
+void setPortInput(uint8_t pin, uint8_t value)
+{
+	uint32_t reg = g_portInputRegisters[digitalPinToPort(pin)];
+	if (value)
+		reg |= digitalPinToBitMask(pin);
+	else
+		reg &= ~digitalPinToBitMask(pin);
+	g_portInputRegisters[digitalPinToPort(pin)] = reg;
+}
+
+void resetPortInputs()
+{
+	for (uint8_t i = 0; i < 32; ++i)
+		g_portInputRegisters[i] = 0;
+	for (auto &pinState : g_pinStates)
+		setPortInput(pinState.first, pinState.second);
 }
 
 uint32_t totalDelay()
@@ -122,12 +156,75 @@ void attachInterruptInterval(uint8_t interval, void (*userFunc)(void))
 	g_intervalInterrupts.push_back(interrupt);
 }
 
-void tone(uint8_t /*_pin*/, unsigned int /*frequency*/, unsigned long /*duration*/)
+void detachInterruptInterval()
+{
+	g_intervalInterrupts.clear();
+}
+
+void attachInterruptOneShot(uint32_t delay, void (*userFunc)(void))
+{
+	g_oneShotISR = userFunc;
+	g_oneShotTime = micros() + delay;
+}
+
+void detachInterruptOneShot()
+{
+	g_oneShotISR = nullptr;
+}
+
+bool nextTimerInterrupt(uint32_t &time)
+{
+	bool armed = false;
+	for (IntervalInterrupt &interrupt : g_intervalInterrupts)
+	{
+		uint32_t t = interrupt.t + interrupt.interval;
+		if (!armed || int32_t(t - time) < 0)
+			time = t;
+		armed = true;
+	}
+	if (g_oneShotISR && (!armed || int32_t(g_oneShotTime - time) < 0))
+	{
+		time = g_oneShotTime;
+		armed = true;
+	}
+	return armed;
+}
+
+void runTimerInterrupt()
+{
+	uint32_t time;
+	if (!nextTimerInterrupt(time))
+		return;
+	++g_timerInterrupts;
+	if (g_oneShotISR && g_oneShotTime == time)
+	{
+		void (*isr)(void) = g_oneShotISR;
+		g_oneShotISR = nullptr;
+		// May arm again.
+		isr();
+		return;
+	}
+	for (IntervalInterrupt &interrupt : g_intervalInterrupts)
+	{
+		if (interrupt.t + interrupt.interval == time)
+		{
+			interrupt.t = time;
+			interrupt.isr();
+			return;
+		}
+	}
+}
+
+void tone(uint8_t _pin, unsigned int frequency, unsigned long /*duration*/)
 {
+	g_toneLog[_pin].push_back(frequency);
+	g_toneTimeLog[_pin].push_back(micros());
 }
 
-void noTone(uint8_t /*_pin*/)
+void noTone(uint8_t _pin)
 {
+	g_toneLog[_pin].push_back(0);
+	g_toneTimeLog[_pin].push_back(micros());
 }
 
 void InsError(uint32_t error)
@@ -3,9 +3,13 @@
 #ifndef _INS_TESTDUMMIES_H_
 #define _INS_TESTDUMMIES_H_
 
+#include <functional>
 #include <map>
 #include <vector>
+#include <stdarg.h>
 #include <stdint.h>
+#include <stdio.h>
+#include <string.h>
 
 // Mock functions for Arduino.h
 
@@ -29,24 +33,67 @@ void digitalWrite(uint8_t pin, uint8_t value);
 
 #define digitalPinToInterrupt(p)  (p)
 
+// Port input registers for INS_PORT_SAMPLING, 8 pins per port as on AVR.
+// Updated by digitalWrite() and Simulator.
+#define digitalPinToPort(p)  ((p) >> 3)
+#define digitalPinToBitMask(p)  (1U << ((p) & 7))
+#define portInputRegister(port)  (&g_portInputRegisters[port])
+
+extern volatile uint32_t g_portInputRegisters[32];
+
 void attachInterrupt(uint8_t interruptNum, std::function<void(void)> userFunc, int mode);
 void attachInterrupt(uint8_t interruptNum, void (*userFunc)(void), int mode);
 void detachInterrupt(uint8_t interruptNum);
 
 void attachInterruptInterval(uint8_t interval, void (*userFunc)(void));
+void detachInterruptInterval();
+// Calls userFunc once after delay, replaces any armed one-shot.
+void attachInterruptOneShot(uint32_t delay, void (*userFunc)(void));
+void detachInterruptOneShot();
+
+// Timer interrupts run from delayMicroseconds(), or by Simulator when hooked.
+// Time of the earliest armed timer interrupt.
+bool nextTimerInterrupt(uint32_t &time);
+// Runs the earliest timer interrupt, micros() should return its time.
+void runTimerInterrupt();
 
 void tone(uint8_t _pin, unsigned int frequency, unsigned long duration = 0);
 void noTone(uint8_t _pin);
 
+// Replaces micros(), delayMicroseconds(), pinMode(), digitalRead() and digitalWrite() when set.
+// Nothing is logged while hooked. See Simulator.h.
+class DummyHooks
+{
+public:
+	virtual uint32_t DummyHooks_micros() = 0;
+	virtual void DummyHooks_delayMicroseconds(unsigned int us) = 0;
+	virtual void DummyHooks_pinMode(uint8_t pin, uint8_t mode) = 0;
+	virtual int DummyHooks_digitalRead(uint8_t pin) = 0;
+	virtual void DummyHooks_digitalWrite(uint8_t pin, uint8_t value) = 0;
+};
+
+extern DummyHooks *g_dummyHooks;
+extern std::map<uint8_t, std::function<void(void)>> g_pinInterrupts;
+
 // Log information for tests
 
 void resetLogs();
 uint32_t totalDelay();
 
+// Update the port input register bit of pin.
+void setPortInput(uint8_t pin, uint8_t value);
+// Restore all port input registers from g_pinStates.
+void resetPortInputs();
+
 extern std::vector<uint32_t> g_delayMicrosecondsLog;
 extern std::map<uint8_t, std::vector<uint8_t>> g_digitalWriteStateLog;
 extern std::map<uint8_t, std::vector<uint32_t>> g_digitalWriteTimeLog;
 extern std::map<uint8_t, uint8_t> g_pinStates;
 extern std::map<uint8_t, uint32_t> g_lastWrite;
+// tone() frequencies and times, noTone() logs 0.
+extern std::map<uint8_t, std::vector<unsigned>> g_toneLog;
+extern std::map<uint8_t, std::vector<uint32_t>> g_toneTimeLog;
+// Interval and one-shot timer interrupt calls.
+extern unsigned g_timerInterrupts;
 
 #endif
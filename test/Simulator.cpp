@@ -0,0 +1,235 @@
+// Copyright (c) 2024 Daniel Wallner
+
+#include "Simulator.h"
+
+#include <assert.h>
+
+using namespace inseparates;
+
+Simulator::Simulator(uint32_t seed, uint32_t startMicros) :
+	_startMicros(startMicros),
+	_random(seed ? seed : 1)
+{
+	assert(!g_dummyHooks);
+	g_dummyHooks = this;
+	for (uint8_t pin = 0; pin < kMaxPins; ++pin)
+	{
+		setPortInput(pin, LOW);
+	}
+}
+
+Simulator::~Simulator()
+{
+	g_dummyHooks = nullptr;
+	resetPortInputs();
+}
+
+uint8_t Simulator::addWire(std::initializer_list<uint8_t> pins, uint8_t pullLevel)
+{
+	uint8_t index = _wires.size();
+	Wire wire;
+	wire.pullLevel = pullLevel;
+	wire.level = pullLevel;
+	for (uint8_t pin : pins)
+	{
+		assert(pin < kMaxPins);
+		assert(_pins[pin].wire == kNoWire);
+		wire.pins.push_back(pin);
+		_pins[pin].wire = index;
+		_pins[pin].input = pullLevel;
+		setPortInput(pin, pullLevel);
+	}
+	_wires.push_back(wire);
+	updateWire(index);
+	return index;
+}
+
+void Simulator::setJitter(uint8_t wire, uint16_t maxMicros)
+{
+	_wires[wire].jitter = maxMicros;
+}
+
+void Simulator::setInterruptLatency(uint16_t minMicros, uint16_t maxMicros)
+{
+	assert(minMicros <= maxMicros);
+	_latencyMin = minMicros;
+	_latencyMax = maxMicros;
+}
+
+void Simulator::setPollInterval(uint16_t interval)
+{
+	assert(interval);
+	_pollInterval = interval;
+}
+
+void Simulator::advance(uint64_t duration)
+{
+	processUntil(_now + duration, false);
+}
+
+void Simulator::run(Scheduler &scheduler, uint64_t duration)
+{
+	runUntil(scheduler, nullptr, duration);
+}
+
+bool Simulator::runUntil(Scheduler &scheduler, const std::function<bool()> &done, uint64_t duration)
+{
+	uint64_t end = _now + duration;
+	for (;;)
+	{
+		scheduler.poll();
+		if (done && done())
+			return true;
+		if (_now >= end)
+			return false;
+
+		uint64_t next = end;
+		ins_micros_t deadline = 0;
+		if (scheduler.nextDeadline(deadline))
+		{
+			ins_smicros_t left = deadline - fastMicros();
+			if (left < 0)
+				left = 0;
+			if (_now + left < next)
+				next = _now + left;
+		}
+		uint64_t earliest = _now + _pollInterval;
+		if (next < earliest)
+			next = earliest;
+
+		// An interrupt wakes the main loop, it polls within one poll interval.
+		uint64_t interrupt = processUntil(next, true);
+		if (interrupt < next)
+		{
+			next = interrupt < earliest ? earliest : interrupt;
+			processUntil(next, false);
+		}
+	}
+}
+
+void Simulator::DummyHooks_pinMode(uint8_t pin, uint8_t mode)
+{
+	assert(pin < kMaxPins);
+	_pins[pin].mode = mode;
+	if (_pins[pin].wire != kNoWire)
+		updateWire(_pins[pin].wire);
+}
+
+void Simulator::DummyHooks_digitalWrite(uint8_t pin, uint8_t value)
+{
+	assert(pin < kMaxPins);
+	_pins[pin].output = value;
+	if (_pins[pin].wire != kNoWire)
+	{
+		updateWire(_pins[pin].wire);
+		return;
+	}
+	Event event = { _now, _sequence++, kEdge, pin, value };
+	process(event);
+}
+
+uint32_t Simulator::random(uint32_t max)
+{
+	if (!max)
+		return 0;
+	// xorshift32
+	_random ^= _random << 13;
+	_random ^= _random >> 17;
+	_random ^= _random << 5;
+	return _random % (max + 1);
+}
+
+void Simulator::push(uint64_t time, EventType type, uint8_t pin, uint8_t level)
+{
+	Event event = { time, _sequence++, type, pin, level };
+	_events.push(event);
+}
+
+void Simulator::updateWire(uint8_t wireIndex)
+{
+	Wire &wire = _wires[wireIndex];
+	uint8_t level = wire.pullLevel;
+	for (uint8_t pin : wire.pins)
+	{
+		if (_pins[pin].mode == OUTPUT && _pins[pin].output != wire.pullLevel)
+		{
+			level = _pins[pin].output;
+			break;
+		}
+	}
+	if (level == wire.level)
+		return;
+	wire.level = level;
+	for (uint8_t pin : wire.pins)
+	{
+		deliver(pin, level, wire.jitter);
+	}
+}
+
+void Simulator::deliver(uint8_t pinIndex, uint8_t level, uint16_t jitter)
+{
+	Pin &pin = _pins[pinIndex];
+	uint64_t arrival = _now + random(jitter);
+	if (arrival < pin.lastArrival)
+		arrival = pin.lastArrival;
+	pin.lastArrival = arrival;
+	push(arrival, kEdge, pinIndex, level);
+}
+
+bool Simulator::process(const Event &event)
+{
+	Pin &pin = _pins[event.pin];
+	if (event.type == kEdge)
+	{
+		if (pin.input == event.level)
+			return false;
+		pin.input = event.level;
+		setPortInput(event.pin, event.level);
+		++_edges;
+		if (!g_pinInterrupts.count(event.pin))
+			return false;
+		uint64_t time = _now + _latencyMin + random(_latencyMax - _latencyMin);
+		if (time < pin.lastInterrupt)
+			time = pin.lastInterrupt;
+		pin.lastInterrupt = time;
+		push(time, kInterrupt, event.pin, 0);
+		return false;
+	}
+
+	auto isr = g_pinInterrupts.find(event.pin);
+	if (isr == g_pinInterrupts.end())
+		return false;
+	isr->second();
+	return true;
+}
+
+uint64_t Simulator::processUntil(uint64_t until, bool stopAtInterrupt)
+{
+	for (;;)
+	{
+		// Timer interrupts only write outputs and do not wake the main loop.
+		uint32_t timerMicros;
+		if (nextTimerInterrupt(timerMicros))
+		{
+			int32_t offset = timerMicros - DummyHooks_micros();
+			uint64_t timer = offset > 0 ? _now + offset : _now;
+			if (timer <= until && (_events.empty() || timer < _events.top().time))
+			{
+				_now = timer;
+				runTimerInterrupt();
+				continue;
+			}
+		}
+		if (_events.empty() || _events.top().time > until)
+			break;
+		Event event = _events.top();
+		_events.pop();
+		if (event.time > _now)
+			_now = event.time;
+		if (process(event) && stopAtInterrupt)
+			return _now;
+	}
+	if (until > _now)
+		_now = until;
+	return until;
+}
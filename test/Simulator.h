@@ -0,0 +1,129 @@
+// Copyright (c) 2024 Daniel Wallner
+
+// Discrete-event simulation of time and pins for host tests.
+// While a Simulator exists it replaces the logging mocks in Dummies.cpp:
+// micros() returns virtual time, pinMode() and digitalWrite() drive wires
+// and input interrupts run after a modelled latency.
+// The real Scheduler is polled, idle time is skipped using Scheduler::nextDeadline().
+// Timer interrupts from attachInterruptInterval() and attachInterruptOneShot() run at their time.
+
+#ifndef _INS_SIMULATOR_H_
+#define _INS_SIMULATOR_H_
+
+#include "Dummies.h"
+#include "../src/Inseparates.h"
+
+#include <functional>
+#include <initializer_list>
+#include <queue>
+#include <vector>
+
+class Simulator : public DummyHooks
+{
+public:
+	static const uint8_t kMaxPins = 64;
+	static const uint8_t kNoWire = 0xFF;
+
+	// Starts close to wraparound of micros() by default.
+	Simulator(uint32_t seed = 1, uint32_t startMicros = 0xFFFF0000);
+	~Simulator();
+
+	// Connects pins and returns the wire index.
+	// The wire is at pullLevel unless a pin drives the opposite level,
+	// so pullLevel HIGH is an open drain wired-AND bus with a pull-up.
+	// Pins that are not connected read back their own output.
+	uint8_t addWire(std::initializer_list<uint8_t> pins, uint8_t pullLevel = LOW);
+
+	// Edges reach each input on the wire 0 to maxMicros late, in order.
+	void setJitter(uint8_t wire, uint16_t maxMicros);
+
+	// Time from an input edge to its interrupt handler.
+	void setInterruptLatency(uint16_t minMicros, uint16_t maxMicros);
+
+	// Minimum time between two polls, i.e. the main loop period.
+	void setPollInterval(uint16_t interval);
+
+	uint64_t now() const { return _now; }
+	uint8_t wireLevel(uint8_t wire) const { return _wires[wire].level; }
+	// Number of edges that have reached inputs.
+	uint64_t edges() const { return _edges; }
+
+	// Advance time without polling.
+	void advance(uint64_t duration);
+
+	// Poll scheduler for duration microseconds of simulated time.
+	void run(inseparates::Scheduler &scheduler, uint64_t duration);
+
+	// As run() but stops after the first poll where done() returns true.
+	// Returns false if duration passed first.
+	bool runUntil(inseparates::Scheduler &scheduler, const std::function<bool()> &done, uint64_t duration);
+
+	uint32_t DummyHooks_micros() override { return uint32_t(_startMicros + _now); }
+	void DummyHooks_delayMicroseconds(unsigned int us) override { advance(us); }
+	void DummyHooks_pinMode(uint8_t pin, uint8_t mode) override;
+	int DummyHooks_digitalRead(uint8_t pin) override { return _pins[pin].input; }
+	void DummyHooks_digitalWrite(uint8_t pin, uint8_t value) override;
+
+private:
+	struct Pin
+	{
+		uint8_t wire = kNoWire;
+		uint8_t mode = INPUT;
+		uint8_t output = LOW;
+		uint8_t input = LOW;
+		uint64_t lastArrival = 0;
+		uint64_t lastInterrupt = 0;
+	};
+
+	struct Wire
+	{
+		std::vector<uint8_t> pins;
+		uint8_t pullLevel;
+		uint8_t level;
+		uint16_t jitter = 0;
+	};
+
+	enum EventType : uint8_t
+	{
+		kEdge,
+		kInterrupt,
+	};
+
+	struct Event
+	{
+		uint64_t time;
+		uint32_t sequence;
+		EventType type;
+		uint8_t pin;
+		uint8_t level;
+
+		bool operator>(const Event &other) const
+		{
+			return time != other.time ? time > other.time : sequence > other.sequence;
+		}
+	};
+
+	uint64_t _now = 0;
+	uint32_t _startMicros;
+	uint32_t _random;
+	uint32_t _sequence = 0;
+	uint64_t _edges = 0;
+	uint16_t _latencyMin = 0;
+	uint16_t _latencyMax = 0;
+	uint16_t _pollInterval = 1;
+	Pin _pins[kMaxPins];
+	std::vector<Wire> _wires;
+	std::priority_queue<Event, std::vector<Event>, std::greater<Event>> _events;
+
+	// Uniform in [0, max].
+	uint32_t random(uint32_t max);
+	void push(uint64_t time, EventType type, uint8_t pin, uint8_t level);
+	void updateWire(uint8_t wire);
+	void deliver(uint8_t pin, uint8_t level, uint16_t jitter);
+	// Returns true if an interrupt handler ran.
+	bool process(const Event &event);
+	// Handle events up to until and return the time of the first interrupt, or until.
+	uint64_t processUntil(uint64_t until, bool stopAtInterrupt);
+};
+
+#endif
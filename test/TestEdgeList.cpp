@@ -0,0 +1,102 @@
+// Copyright (c) 2024 Daniel Wallner
+
+#include <gtest/gtest.h>
+#include <gmock/gmock.h>
+
+#include "../src/ProtocolESI.h"
+#include "../src/ProtocolNEC.h"
+#include "../src/ProtocolRC5.h"
+#include "../src/ProtocolSIRC.h"
+
+#include <functional>
+#include <vector>
+
+using namespace inseparates;
+
+namespace
+{
+
+// Runs a task prepared by prepare on pin and on an EdgeList, then checks that replay gives the same writes.
+template<typename Tx>
+void expectSameReplay(const std::function<void(Tx&)> &prepare)
+{
+	const uint8_t pin = 5;
+	PushPullPinWriter pinWriter(pin);
+
+	resetLogs();
+	Tx tx(&pinWriter, HIGH);
+	prepare(tx);
+	Scheduler::run(&tx);
+	std::vector<uint8_t> states = g_digitalWriteStateLog[pin];
+	std::vector<uint32_t> times = g_digitalWriteTimeLog[pin];
+	uint32_t duration = totalDelay();
+
+	EdgeList list;
+	Tx renderer(&list, HIGH);
+	prepare(renderer);
+	EXPECT_TRUE(list.render(&renderer));
+
+	resetLogs();
+	EdgePlayer player(&pinWriter);
+	player.prepare(&list);
+	Scheduler::run(&player);
+	EXPECT_THAT(g_digitalWriteStateLog[pin], testing::ElementsAreArray(states));
+	EXPECT_THAT(g_digitalWriteTimeLog[pin], testing::ElementsAreArray(times));
+	EXPECT_EQ(duration, totalDelay());
+
+	// Again.
+	resetLogs();
+	player.prepare(&list);
+	Scheduler::run(&player);
+	EXPECT_THAT(g_digitalWriteStateLog[pin], testing::ElementsAreArray(states));
+	resetLogs();
+}
+
+}
+
+TEST(EdgeListTest, Replay)
+{
+	expectSameReplay<TxRC5>([](TxRC5 &tx) { tx.prepare(TxRC5::encodeRC5(1, 0x05, 0x35)); });
+	expectSameReplay<TxRC5>([](TxRC5 &tx) { tx.prepare(TxRC5::encodeRC5(0, 0x1F, 0x3F), false); });
+	expectSameReplay<TxNEC>([](TxNEC &tx) { tx.prepare(0xE718FF00); });
+	expectSameReplay<TxSIRC>([](TxSIRC &tx) { tx.prepare(0x12345, 20); });
+	expectSameReplay<TxESI>([](TxESI &tx) { tx.prepare(0x123456789, 36); });
+}
+
+TEST(EdgeListTest, Overflow)
+{
+	EdgeList list;
+	TxJam jam(&list, HIGH, 1000000);
+	// A long sleep that is not last is split.
+	EXPECT_TRUE(list.render(&jam));
+	EXPECT_EQ(1 + (1000000 + SteppedTask::kMaxSleepMicros - 1) / SteppedTask::kMaxSleepMicros + 1, list.size());
+	EXPECT_EQ(0u, list.tailMicros());
+
+	TxESI esi(&list, HIGH);
+	esi.prepare(0, 64);
+	EXPECT_EQ(INS_EDGE_LIST_LENGTH > 130, list.render(&esi));
+}
+
+TEST(EdgeListTest, Cache)
+{
+	EdgeListCache<2> cache;
+	TxRC5 rc5(&cache, HIGH);
+	TxNEC nec(&cache, HIGH);
+
+	rc5.prepare(0x3001);
+	const EdgeList *rc5List = cache.get(&rc5, 0x3001);
+	ASSERT_NE(nullptr, rc5List);
+	EXPECT_NE(0u, rc5List->size());
+	nec.prepare(0x3001);
+	const EdgeList *necList = cache.get(&nec, 0x3001);
+	ASSERT_NE(nullptr, necList);
+	EXPECT_NE(rc5List, necList);
+	EXPECT_EQ(rc5List, cache.get(&rc5, 0x3001));
+
+	// Replaces NEC, the least recently used.
+	rc5.prepare(0x3002);
+	EXPECT_EQ(necList, cache.get(&rc5, 0x3002));
+	EXPECT_EQ(rc5List, cache.get(&rc5, 0x3001));
+	nec.prepare(0x3001);
+	EXPECT_EQ(necList, cache.get(&nec, 0x3001));
+}
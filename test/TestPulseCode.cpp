@@ -0,0 +1,79 @@
+// Copyright (c) 2024 Daniel Wallner
+
+#include <gtest/gtest.h>
+#include <gmock/gmock.h>
+
+#include "../src/ProtocolNEC.h"
+
+#include <array>
+#include <vector>
+
+using namespace inseparates;
+
+// NEC with a shorter header, as used by Samsung.
+struct Samsung32Code : NECCode
+{
+	static constexpr uint16_t kHeaderMark = 4500;
+	static constexpr uint16_t kHeaderMarkMin = 4000;
+	static constexpr uint16_t kHeaderMarkMax = 5000;
+	static constexpr uint16_t kTimeout = kHeaderMarkMax + kHeaderSpaceMin;
+};
+
+TEST(PulseCodeTest, Variant)
+{
+	class Decoder : public RxPulseCode<Samsung32Code>
+	{
+	public:
+		std::vector<uint32_t> received;
+		std::vector<uint8_t> bits;
+
+		Decoder() : RxPulseCode(HIGH, 0) {}
+
+	protected:
+		void RxPulseCode_data(uint32_t data, uint8_t bits_) override
+		{
+			received.push_back(data);
+			bits.push_back(bits_);
+		}
+	};
+
+	uint8_t pin = 5;
+	PushPullPinWriter pinWriter(pin);
+	TxPulseCode<Samsung32Code> tx(&pinWriter, HIGH);
+	Decoder decoder;
+
+	uint32_t data = 0xE0E040BF;
+	resetLogs();
+	digitalWrite(pin, LOW);
+	delayMicroseconds(12345);
+	tx.prepare(data);
+	Scheduler::run(&tx);
+	ASSERT_EQ(69u, g_digitalWriteTimeLog[pin].size());
+	std::array<uint32_t, 6> header { 0, 12345, 4500, 4500, 562, 1688 };
+	EXPECT_THAT(header, testing::ElementsAreArray(g_digitalWriteTimeLog[pin].begin(), g_digitalWriteTimeLog[pin].begin() + 6));
+	EXPECT_EQ(12345u + 110000, totalDelay());
+	for (unsigned i = 0; i < g_digitalWriteStateLog[pin].size(); i++)
+	{
+		decoder.Decoder_pulse(1 ^ g_digitalWriteStateLog[pin][i], g_digitalWriteTimeLog[pin][i]);
+	}
+
+	// Repeat code, delivered at timeout after the trailer mark.
+	resetLogs();
+	tx.prepare(0, 0);
+	Scheduler::run(&tx);
+	std::array<uint32_t, 4> repeat { 0, 4500, 2250, 562 };
+	EXPECT_THAT(repeat, testing::ElementsAreArray(g_digitalWriteTimeLog[pin]));
+	for (unsigned i = 0; i < g_digitalWriteStateLog[pin].size(); i++)
+	{
+		decoder.Decoder_pulse(1 ^ g_digitalWriteStateLog[pin][i], g_digitalWriteTimeLog[pin][i]);
+	}
+	decoder.Decoder_timeout(g_digitalWriteStateLog[pin].back());
+
+	// Standard NEC header is rejected.
+	EXPECT_EQ(0, decoder.Decoder_pulse(HIGH, 9000));
+
+	std::vector<uint32_t> expected { data, 0 };
+	EXPECT_THAT(decoder.received, testing::ElementsAreArray(expected));
+	std::vector<uint8_t> expectedBits { 32, 0 };
+	EXPECT_THAT(decoder.bits, testing::ElementsAreArray(expectedBits));
+}
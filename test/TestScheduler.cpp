@@ -0,0 +1,989 @@
+// Copyright (c) 2024 Daniel Wallner
+
+#include <gtest/gtest.h>
+#include <gmock/gmock.h>
+
+#include "../src/Inseparates.h"
+#include "../src/ProtocolUtils.h"
+
+#include <atomic>
+#include <memory>
+#include <thread>
+#include <vector>
+
+using namespace inseparates;
+
+namespace
+{
+
+class PeriodicTask : public SteppedTask
+{
+	uint16_t _period;
+	unsigned _steps;
+public:
+	std::vector<uint32_t> stepTimes;
+
+	PeriodicTask(uint16_t period, unsigned steps) : _period(period), _steps(steps) {}
+
+	uint16_t SteppedTask_step() override
+	{
+		stepTimes.push_back(micros());
+		if (stepTimes.size() >= _steps)
+			return kInvalidDelta;
+		return _period;
+	}
+};
+
+class DoneCounter : public Scheduler::Delegate
+{
+public:
+	std::vector<SteppedTask*> done;
+
+	void SchedulerDelegate_done(SteppedTask *task) override
+	{
+		done.push_back(task);
+	}
+};
+
+void runScheduler(Scheduler &scheduler, uint32_t micros, uint16_t step = 10)
+{
+	for (uint32_t t = 0; t < micros; t += step)
+	{
+		scheduler.poll();
+		delayMicroseconds(step);
+	}
+}
+
+}
+
+TEST(SchedulerTest, TaskOrder)
+{
+	resetLogs();
+	Scheduler scheduler;
+	DoneCounter doneCounter;
+	PeriodicTask slow(3000, 5);
+	PeriodicTask fast(1000, 10);
+	PeriodicTask medium(2000, 5);
+
+	EXPECT_TRUE(scheduler.add(&slow, &doneCounter));
+	EXPECT_TRUE(scheduler.add(&fast, &doneCounter));
+	EXPECT_TRUE(scheduler.add(&medium, &doneCounter));
+	EXPECT_TRUE(scheduler.active(&slow));
+	EXPECT_TRUE(scheduler.active(&fast));
+	EXPECT_TRUE(scheduler.active(&medium));
+
+	runScheduler(scheduler, 20000);
+
+	ASSERT_EQ(5u, slow.stepTimes.size());
+	ASSERT_EQ(10u, fast.stepTimes.size());
+	ASSERT_EQ(5u, medium.stepTimes.size());
+	for (unsigned i = 1; i < fast.stepTimes.size(); ++i)
+	{
+		EXPECT_EQ(1000u, fast.stepTimes[i] - fast.stepTimes[i - 1]);
+	}
+	for (unsigned i = 1; i < slow.stepTimes.size(); ++i)
+	{
+		EXPECT_EQ(3000u, slow.stepTimes[i] - slow.stepTimes[i - 1]);
+	}
+
+	EXPECT_FALSE(scheduler.active(&slow));
+	EXPECT_FALSE(scheduler.active(&fast));
+	EXPECT_FALSE(scheduler.active(&medium));
+	std::vector<SteppedTask*> expectedDone { &medium, &fast, &slow };
+	EXPECT_THAT(doneCounter.done, testing::ElementsAreArray(expectedDone));
+}
+
+TEST(SchedulerTest, AddRemove)
+{
+	resetLogs();
+	Scheduler scheduler;
+	std::vector<PeriodicTask> tasks;
+	for (unsigned i = 0; i < INS_SEQUENCER_MAX_NUM_TASKS; ++i)
+	{
+		tasks.emplace_back(100 + i, 1000);
+	}
+	for (auto &task : tasks)
+	{
+		EXPECT_TRUE(scheduler.add(&task));
+	}
+	for (unsigned i = 0; i < tasks.size(); i += 2)
+	{
+		EXPECT_TRUE(scheduler.remove(&tasks[i]));
+	}
+	for (unsigned i = 0; i < tasks.size(); ++i)
+	{
+		EXPECT_EQ(i & 1, scheduler.active(&tasks[i]));
+	}
+
+	runScheduler(scheduler, 1000);
+
+	for (unsigned i = 0; i < tasks.size(); ++i)
+	{
+		if (i & 1)
+			EXPECT_LT(1u, tasks[i].stepTimes.size());
+		else
+			EXPECT_EQ(1u, tasks[i].stepTimes.size());
+	}
+
+	// Freed slots can be reused.
+	for (unsigned i = 0; i < tasks.size(); i += 2)
+	{
+		EXPECT_TRUE(scheduler.addDelayed(&tasks[i], 500));
+		EXPECT_TRUE(scheduler.active(&tasks[i]));
+	}
+}
+
+TEST(SchedulerTest, RemoveWhileStepping)
+{
+	class RemovingTask : public SteppedTask
+	{
+		Scheduler &_scheduler;
+		SteppedTask *_victim;
+	public:
+		RemovingTask(Scheduler &scheduler, SteppedTask *victim) : _scheduler(scheduler), _victim(victim) {}
+
+		uint16_t SteppedTask_step() override
+		{
+			if (_victim && _scheduler.active(_victim))
+				_scheduler.remove(_victim);
+			_victim = nullptr;
+			return 1000;
+		}
+	};
+
+	resetLogs();
+	Scheduler scheduler;
+	PeriodicTask victim(1000, 100);
+	RemovingTask remover(scheduler, &victim);
+
+	EXPECT_TRUE(scheduler.add(&victim));
+	EXPECT_TRUE(scheduler.addDelayed(&remover, 1000));
+
+	// Both are due at the same time, the victim must not be stepped after being removed.
+	runScheduler(scheduler, 5000);
+
+	EXPECT_FALSE(scheduler.active(&victim));
+	EXPECT_GE(2u, victim.stepTimes.size());
+	EXPECT_TRUE(scheduler.active(&remover));
+}
+
+TEST(SchedulerTest, LongSleep)
+{
+	class SleepyTask : public SteppedTask
+	{
+	public:
+		std::vector<uint32_t> stepTimes;
+
+		uint16_t SteppedTask_step() override
+		{
+			stepTimes.push_back(micros());
+			if (stepTimes.size() >= 3)
+				return kInvalidDelta;
+			return longSleep(stepTimes.size() == 1 ? 150000 : 1000);
+		}
+	};
+
+	resetLogs();
+	Scheduler scheduler;
+	SleepyTask task;
+	uint32_t start = micros();
+	EXPECT_TRUE(scheduler.addDelayed(&task, 100000));
+	ins_micros_t deadline;
+	EXPECT_TRUE(scheduler.nextDeadline(deadline));
+	EXPECT_EQ(ins_micros_t(start + 100000), deadline);
+	runScheduler(scheduler, 260000);
+	std::vector<uint32_t> expected { start + 100000, start + 250000, start + 251000 };
+	EXPECT_THAT(task.stepTimes, testing::ElementsAreArray(expected));
+	EXPECT_FALSE(scheduler.active(&task));
+
+	task.stepTimes.clear();
+	resetLogs();
+	Scheduler::runFor(&task, 3);
+	EXPECT_EQ(151000u, totalDelay());
+	resetLogs();
+}
+
+TEST(SchedulerTest, InterruptWriteQueues)
+{
+	class ToggleTask : public SteppedTask
+	{
+		PinWriter *_pin;
+		unsigned _steps;
+		unsigned _count = 0;
+	public:
+		ToggleTask(PinWriter *pin, unsigned steps) : _pin(pin), _steps(steps) {}
+
+		uint16_t SteppedTask_step() override
+		{
+			_pin->write(_count & 1);
+			return ++_count < _steps ? 20 : kInvalidDelta;
+		}
+	};
+
+	resetLogs();
+	InterruptWriteScheduler writeScheduler(10);
+	// More pins than there were shared channels before, each task longer than its FIFO.
+	const uint8_t kPins = 8;
+	std::vector<std::unique_ptr<InterruptPinWriter>> writers;
+	std::vector<std::unique_ptr<ToggleTask>> tasks;
+	for (uint8_t i = 0; i < kPins; ++i)
+	{
+		writers.emplace_back(new InterruptPinWriter(&writeScheduler, 10 + i));
+		tasks.emplace_back(new ToggleTask(writers.back().get(), INS_OUTPUT_FIFO_LENGTH + 10));
+	}
+	ToggleTask task2(writers[0].get(), 3);
+	DoneCounter doneCounter;
+
+	for (uint8_t i = 0; i < kPins; ++i)
+		EXPECT_TRUE(writeScheduler.add(tasks[i].get(), 10 + i, &doneCounter));
+	// Waits for tasks[0].
+	EXPECT_TRUE(writeScheduler.add(&task2, 10, &doneCounter));
+	writeScheduler.SteppedTask_step();
+	EXPECT_TRUE(doneCounter.done.empty());
+
+	for (unsigned i = 0; i < 1000; ++i)
+	{
+		delayMicroseconds(10);
+		timerISR();
+		writeScheduler.SteppedTask_step();
+	}
+	// task2 follows tasks[0] on its pin.
+	std::vector<SteppedTask*> expected;
+	for (auto &task : tasks)
+		expected.push_back(task.get());
+	expected.push_back(&task2);
+	EXPECT_THAT(doneCounter.done, testing::ElementsAreArray(expected));
+	// Each push-pull write is two digitalWrite() calls.
+	EXPECT_EQ(1 + 2 * (INS_OUTPUT_FIFO_LENGTH + 10 + 3), g_digitalWriteStateLog[10].size());
+	for (uint8_t i = 1; i < kPins; ++i)
+	{
+		EXPECT_EQ(1 + 2 * (INS_OUTPUT_FIFO_LENGTH + 10), g_digitalWriteStateLog[10 + i].size());
+		// All pins were written concurrently.
+		EXPECT_EQ(g_digitalWriteTimeLog[10][1], g_digitalWriteTimeLog[10 + i][1]);
+	}
+	resetLogs();
+}
+
+TEST(SchedulerTest, InterruptWriteDoneWithFullQueue)
+{
+	class ToggleTask : public SteppedTask
+	{
+		PinWriter *_pin;
+		unsigned _count = 0;
+	public:
+		ToggleTask(PinWriter *pin) : _pin(pin) {}
+
+		uint16_t SteppedTask_step() override
+		{
+			_pin->write(_count & 1);
+			return ++_count < 3 ? 20 : kInvalidDelta;
+		}
+	};
+
+	resetLogs();
+	InterruptWriteScheduler writeScheduler(10);
+	InterruptPinWriter writer(&writeScheduler, 5);
+	DoneCounter doneCounter;
+	// One running task and a full pool of tasks waiting for the same pin.
+	std::vector<std::unique_ptr<ToggleTask>> tasks;
+	for (uint8_t i = 0; i < 1 + INS_OUTPUT_MAX_QUEUED_TASKS; ++i)
+	{
+		tasks.emplace_back(new ToggleTask(&writer));
+		EXPECT_TRUE(writeScheduler.add(tasks.back().get(), 5, &doneCounter));
+	}
+
+	for (unsigned i = 0; i < 1000; ++i)
+	{
+		delayMicroseconds(10);
+		timerISR();
+		writeScheduler.SteppedTask_step();
+	}
+	// Done callbacks do not need a pool entry.
+	std::vector<SteppedTask*> expected;
+	for (auto &task : tasks)
+		expected.push_back(task.get());
+	EXPECT_THAT(doneCounter.done, testing::ElementsAreArray(expected));
+	resetLogs();
+}
+
+TEST(SchedulerTest, InterruptWriteOneShot)
+{
+	class ToggleTask : public SteppedTask
+	{
+		PinWriter *_pin;
+		unsigned _count = 0;
+	public:
+		ToggleTask(PinWriter *pin) : _pin(pin) {}
+
+		uint16_t SteppedTask_step() override
+		{
+			_pin->write(_count & 1);
+			return ++_count < 4 ? 100 + _count : kInvalidDelta;
+		}
+	};
+
+	resetLogs();
+	InterruptWriteScheduler writeScheduler(30, true);
+	InterruptPinWriter writer(&writeScheduler, 5);
+	ToggleTask task(&writer);
+	writeScheduler.begin();
+	unsigned interrupts = g_timerInterrupts;
+	delayMicroseconds(1000);
+	// Idle, no interrupts.
+	EXPECT_EQ(interrupts, g_timerInterrupts);
+
+	uint32_t start = micros();
+	EXPECT_TRUE(writeScheduler.add(&task, 5));
+	delayMicroseconds(1000);
+	// Each push-pull write is two digitalWrite() calls.
+	std::vector<uint32_t> expected { 0, 1000 + 30, 0, 101, 0, 102, 0, 103, 0 };
+	EXPECT_THAT(g_digitalWriteTimeLog[5], testing::ElementsAreArray(expected));
+	EXPECT_EQ(start + 30 + 101 + 102 + 103, g_lastWrite[5]);
+	// One to find the first write, then one per write.
+	EXPECT_EQ(interrupts + 1 + 4, g_timerInterrupts);
+	delayMicroseconds(1000);
+	EXPECT_EQ(interrupts + 1 + 4, g_timerInterrupts);
+	resetLogs();
+}
+
+TEST(SchedulerTest, SAMDTimerTicks)
+{
+	EXPECT_EQ(1, samdTimerTicks(0));
+	EXPECT_EQ(75, samdTimerTicks(100));
+	EXPECT_EQ(5, samdTimerTicks(7));
+	// Waits longer than 5726 us used to overflow 32 bits and fire early.
+	EXPECT_EQ(7500, samdTimerTicks(10000));
+	EXPECT_EQ(0xFFFF, samdTimerTicks(87380));
+	EXPECT_EQ(0xFFFF, samdTimerTicks(1000000));
+}
+
+TEST(SchedulerTest, InterruptWriteCarrier)
+{
+	class MarkSpaceTask : public SteppedTask
+	{
+		PinWriter *_pin;
+		unsigned _count = 0;
+	public:
+		MarkSpaceTask(PinWriter *pin) : _pin(pin) {}
+
+		uint16_t SteppedTask_step() override
+		{
+			_pin->write(!(_count & 1));
+			return ++_count < 4 ? 500 : kInvalidDelta;
+		}
+	};
+
+	resetLogs();
+	InterruptWriteScheduler writeScheduler(30, true);
+	InterruptPWMPinWriter writer(&writeScheduler, 5, HIGH);
+	writer.prepare(38000, 30);
+	MarkSpaceTask task(&writer);
+	uint32_t start = micros();
+	EXPECT_TRUE(writeScheduler.add(&task, 5));
+	delayMicroseconds(3000);
+	std::vector<unsigned> expected { 38000, 0, 38000, 0 };
+	EXPECT_THAT(g_toneLog[5], testing::ElementsAreArray(expected));
+	std::vector<uint32_t> expectedTimes { start + 30, start + 530, start + 1030, start + 1530 };
+	EXPECT_THAT(g_toneTimeLog[5], testing::ElementsAreArray(expectedTimes));
+	resetLogs();
+}
+
+TEST(SchedulerTest, InterruptWriteStepWithoutWrite)
+{
+	class LastStepSilentTask : public SteppedTask
+	{
+		PinWriter *_pin;
+		unsigned _count = 0;
+	public:
+		LastStepSilentTask(PinWriter *pin) : _pin(pin) {}
+
+		uint16_t SteppedTask_step() override
+		{
+			if (!_count)
+				_pin->write(HIGH);
+			return ++_count < 2 ? 100 : kInvalidDelta;
+		}
+	};
+
+	resetLogs();
+	InterruptWriteScheduler writeScheduler(10);
+	InterruptPinWriter writer(&writeScheduler, 5);
+	InterruptPinWriter directWriter(&writeScheduler, 6);
+	LastStepSilentTask task(&writer);
+	EXPECT_TRUE(writeScheduler.add(&task, 5));
+	writeScheduler.SteppedTask_step();
+	size_t directWrites = g_digitalWriteStateLog[6].size();
+	// Not inside a step, so this goes directly to the pin.
+	directWriter.write(HIGH);
+	EXPECT_EQ(directWrites + 1, g_digitalWriteStateLog[6].size());
+	resetLogs();
+}
+
+TEST(SchedulerTest, DecoderTimeouts)
+{
+	class TimeoutDecoder : public Decoder
+	{
+		uint16_t _timeout;
+	public:
+		std::vector<uint32_t> timeoutTimes;
+		unsigned pulses = 0;
+
+		TimeoutDecoder(uint16_t timeout) : _timeout(timeout) {}
+
+		uint16_t Decoder_pulse(uint8_t /*state*/, uint16_t /*pulseWidth*/) override
+		{
+			++pulses;
+			return _timeout;
+		}
+
+		void Decoder_timeout(uint8_t /*pinState*/) override
+		{
+			timeoutTimes.push_back(micros());
+		}
+	};
+
+	resetLogs();
+	const uint8_t kPin = 3;
+	digitalWrite(kPin, HIGH);
+	Scheduler scheduler;
+	TimeoutDecoder armed(1000);
+	TimeoutDecoder idle(Decoder::kInvalidTimeout);
+	TimeoutDecoder removed(500);
+
+	EXPECT_TRUE(scheduler.add(&armed, kPin));
+	EXPECT_TRUE(scheduler.add(&idle, kPin));
+	EXPECT_TRUE(scheduler.add(&removed, kPin));
+
+	runScheduler(scheduler, 100);
+	digitalWrite(kPin, LOW);
+	uint32_t edgeTime = micros();
+	runScheduler(scheduler, 100);
+	EXPECT_TRUE(scheduler.remove(&removed));
+	runScheduler(scheduler, 3000);
+
+	EXPECT_EQ(1u, armed.pulses);
+	EXPECT_EQ(1u, idle.pulses);
+	EXPECT_EQ(1u, removed.pulses);
+	ASSERT_EQ(1u, armed.timeoutTimes.size());
+	EXPECT_LE(edgeTime + 1000, armed.timeoutTimes[0]);
+	EXPECT_GE(edgeTime + 1020, armed.timeoutTimes[0]);
+	EXPECT_TRUE(idle.timeoutTimes.empty());
+	EXPECT_TRUE(removed.timeoutTimes.empty());
+
+	// A new edge rearms the timeout.
+	digitalWrite(kPin, HIGH);
+	runScheduler(scheduler, 3000);
+	EXPECT_EQ(2u, armed.pulses);
+	EXPECT_EQ(2u, armed.timeoutTimes.size());
+	EXPECT_TRUE(idle.timeoutTimes.empty());
+}
+
+TEST(SchedulerTest, InputFIFOOverflow)
+{
+	class ResyncDecoder : public Decoder
+	{
+	public:
+		unsigned pulses = 0;
+		unsigned resyncs = 0;
+		unsigned pulsesAtResync = 0;
+		uint16_t lastPulseWidth = 0;
+
+		uint16_t Decoder_pulse(uint8_t /*state*/, uint16_t pulseWidth) override
+		{
+			++pulses;
+			lastPulseWidth = pulseWidth;
+			return 1000;
+		}
+
+		void Decoder_timeout(uint8_t /*pinState*/) override {}
+
+		void Decoder_resync() override
+		{
+			++resyncs;
+			pulsesAtResync = pulses;
+		}
+	};
+
+	resetLogs();
+	const uint8_t kPin = 2;
+	const uint8_t kOtherPin = 3;
+	const unsigned kCapacity = INS_INPUT_FIFO_LENGTH - 1;
+	const unsigned kOverflow = 11;
+	digitalWrite(kPin, LOW);
+	digitalWrite(kOtherPin, LOW);
+	Scheduler scheduler;
+	ResyncDecoder decoder;
+	ResyncDecoder other;
+	EXPECT_TRUE(scheduler.add(&decoder, kPin, true));
+	EXPECT_TRUE(scheduler.add(&other, kOtherPin, true));
+
+	// Fill the FIFO from the other pin and overflow it from the decoder pin.
+	digitalWrite(kOtherPin, HIGH);
+	for (unsigned i = 0; i < kCapacity - 1 + kOverflow; ++i)
+	{
+		delayMicroseconds(10);
+		digitalWrite(kPin, !g_pinStates[kPin]);
+	}
+	EXPECT_EQ(kOverflow, scheduler.droppedEdges(kPin));
+	EXPECT_EQ(0u, scheduler.droppedEdges(kOtherPin));
+
+	delayMicroseconds(10);
+	scheduler.poll();
+	EXPECT_EQ(kCapacity, scheduler.inputFIFOMaxUsage());
+	EXPECT_EQ(kCapacity - 1, decoder.pulses);
+	EXPECT_EQ(0u, decoder.resyncs);
+
+	// The decoder is resynced before the first edge after the gap.
+	delayMicroseconds(10);
+	digitalWrite(kPin, !g_pinStates[kPin]);
+	delayMicroseconds(10);
+	scheduler.poll();
+	EXPECT_EQ(1u, decoder.resyncs);
+	EXPECT_EQ(kCapacity - 1, decoder.pulsesAtResync);
+	EXPECT_EQ(kCapacity, decoder.pulses);
+	EXPECT_EQ(0u, decoder.lastPulseWidth);
+	EXPECT_EQ(0u, other.resyncs);
+
+	delayMicroseconds(10);
+	digitalWrite(kPin, !g_pinStates[kPin]);
+	delayMicroseconds(10);
+	scheduler.poll();
+	EXPECT_EQ(1u, decoder.resyncs);
+	EXPECT_EQ(20u, decoder.lastPulseWidth);
+
+	scheduler.resetStatistics();
+	EXPECT_EQ(0u, scheduler.droppedEdges(kPin));
+	EXPECT_EQ(0u, scheduler.inputFIFOMaxUsage());
+}
+
+TEST(SchedulerTest, InterruptInputs)
+{
+	class CountingDecoder : public Decoder
+	{
+	public:
+		unsigned pulses = 0;
+		uint16_t Decoder_pulse(uint8_t /*state*/, uint16_t /*pulseWidth*/) override { ++pulses; return kInvalidTimeout; }
+		void Decoder_timeout(uint8_t /*pinState*/) override {}
+	};
+
+	resetLogs();
+	const uint8_t kFirstPin = 2;
+	CountingDecoder decoders[INS_SEQUENCER_MAX_NUM_INPUTS];
+	{
+		Scheduler scheduler;
+		// Every input can be interrupt driven.
+		for (uint8_t i = 0; i < INS_SEQUENCER_MAX_NUM_INPUTS; ++i)
+		{
+			digitalWrite(kFirstPin + i, LOW);
+			EXPECT_TRUE(scheduler.add(&decoders[i], kFirstPin + i, true));
+		}
+		EXPECT_EQ(size_t(INS_SEQUENCER_MAX_NUM_INPUTS), g_pinInterrupts.size());
+
+		for (uint8_t i = 0; i < INS_SEQUENCER_MAX_NUM_INPUTS; ++i)
+		{
+			for (uint8_t n = 0; n <= i; ++n)
+			{
+				delayMicroseconds(10);
+				digitalWrite(kFirstPin + i, !g_pinStates[kFirstPin + i]);
+			}
+		}
+		delayMicroseconds(10);
+		scheduler.poll();
+		for (uint8_t i = 0; i < INS_SEQUENCER_MAX_NUM_INPUTS; ++i)
+		{
+			EXPECT_EQ(i + 1u, decoders[i].pulses);
+		}
+
+		EXPECT_TRUE(scheduler.remove(&decoders[0]));
+		EXPECT_EQ(0u, g_pinInterrupts.count(kFirstPin));
+		EXPECT_EQ(size_t(INS_SEQUENCER_MAX_NUM_INPUTS - 1), g_pinInterrupts.size());
+	}
+	// Detached when the scheduler is destroyed.
+	EXPECT_TRUE(g_pinInterrupts.empty());
+}
+
+TEST(SchedulerTest, InterruptInputsTwoSchedulers)
+{
+	class CountingDecoder : public Decoder
+	{
+	public:
+		unsigned pulses = 0;
+		uint16_t Decoder_pulse(uint8_t /*state*/, uint16_t /*pulseWidth*/) override { ++pulses; return kInvalidTimeout; }
+		void Decoder_timeout(uint8_t /*pinState*/) override {}
+	};
+
+	resetLogs();
+	const uint8_t kPin1 = 2;
+	const uint8_t kPin2 = 3;
+	digitalWrite(kPin1, LOW);
+	digitalWrite(kPin2, LOW);
+	CountingDecoder decoder1;
+	CountingDecoder decoder2;
+	Scheduler scheduler1;
+	EXPECT_TRUE(scheduler1.add(&decoder1, kPin1, true));
+	{
+		// Both use input index 0.
+		Scheduler scheduler2;
+		EXPECT_TRUE(scheduler2.add(&decoder2, kPin2, true));
+
+		delayMicroseconds(10);
+		digitalWrite(kPin1, HIGH);
+		delayMicroseconds(10);
+		digitalWrite(kPin2, HIGH);
+		delayMicroseconds(10);
+		digitalWrite(kPin2, LOW);
+		delayMicroseconds(10);
+		scheduler1.poll();
+		scheduler2.poll();
+		EXPECT_EQ(1u, decoder1.pulses);
+		EXPECT_EQ(2u, decoder2.pulses);
+	}
+	EXPECT_EQ(0u, g_pinInterrupts.count(kPin2));
+
+	// Still routed to the first scheduler.
+	digitalWrite(kPin1, LOW);
+	delayMicroseconds(10);
+	scheduler1.poll();
+	EXPECT_EQ(2u, decoder1.pulses);
+}
+
+TEST(SchedulerTest, GlitchFilter)
+{
+	class RecordingDecoder : public Decoder
+	{
+	public:
+		std::vector<std::pair<uint8_t, uint16_t>> pulses;
+		unsigned timeouts = 0;
+
+		uint16_t Decoder_pulse(uint8_t state, uint16_t pulseWidth) override
+		{
+			pulses.push_back({ state, pulseWidth });
+			return 150;
+		}
+
+		void Decoder_timeout(uint8_t /*pinState*/) override { ++timeouts; }
+	};
+
+	for (bool interrupt : { false, true })
+	{
+		resetLogs();
+		const uint8_t kPin = 3;
+		digitalWrite(kPin, LOW);
+		Scheduler scheduler;
+		RecordingDecoder decoder;
+		EXPECT_TRUE(scheduler.add(&decoder, kPin, interrupt, 50));
+		uint32_t start = micros();
+		auto at = [&](uint32_t t)
+		{
+			delayMicroseconds(start + t - micros());
+			scheduler.poll();
+		};
+		auto edge = [&](uint32_t t, uint8_t value)
+		{
+			at(t);
+			digitalWrite(kPin, value);
+			scheduler.poll();
+		};
+
+		// Mark glitch.
+		edge(100, HIGH);
+		edge(110, LOW);
+		edge(300, HIGH);
+		at(320);
+		EXPECT_TRUE(decoder.pulses.empty());
+		at(360);
+		ASSERT_EQ(1u, decoder.pulses.size());
+		EXPECT_EQ(LOW, decoder.pulses[0].first);
+		EXPECT_EQ(300u, decoder.pulses[0].second);
+
+		// Space glitch.
+		edge(400, LOW);
+		edge(420, HIGH);
+		// The timeout at 450 must wait for the held edge at 440.
+		edge(440, LOW);
+		at(470);
+		EXPECT_EQ(0u, decoder.timeouts);
+		at(500);
+		ASSERT_EQ(2u, decoder.pulses.size());
+		EXPECT_EQ(HIGH, decoder.pulses[1].first);
+		EXPECT_EQ(140u, decoder.pulses[1].second);
+		EXPECT_EQ(0u, decoder.timeouts);
+
+		at(600);
+		EXPECT_EQ(1u, decoder.timeouts);
+		EXPECT_TRUE(scheduler.remove(&decoder));
+	}
+}
+
+#if INS_PORT_SAMPLING
+TEST(SchedulerTest, PortSampling)
+{
+	class SlowDecoder : public Decoder
+	{
+	public:
+		std::vector<uint16_t> pulseWidths;
+
+		uint16_t Decoder_pulse(uint8_t /*state*/, uint16_t pulseWidth) override
+		{
+			pulseWidths.push_back(pulseWidth);
+			delayMicroseconds(5);
+			return kInvalidTimeout;
+		}
+
+		void Decoder_timeout(uint8_t /*pinState*/) override {}
+	};
+
+	resetLogs();
+	// Two pins in one port and one in another.
+	const uint8_t kPins[] = { 3, 5, 12 };
+	Scheduler scheduler;
+	SlowDecoder decoders[3];
+	for (uint8_t i = 0; i < 3; ++i)
+	{
+		digitalWrite(kPins[i], LOW);
+		EXPECT_TRUE(scheduler.add(&decoders[i], kPins[i]));
+	}
+	scheduler.poll();
+
+	// Simultaneous edges get the same timestamp even though each decoder takes time.
+	delayMicroseconds(100);
+	for (uint8_t i = 0; i < 3; ++i)
+	{
+		digitalWrite(kPins[i], HIGH);
+	}
+	scheduler.poll();
+	delayMicroseconds(100);
+	digitalWrite(kPins[1], LOW);
+	scheduler.poll();
+	scheduler.poll();
+
+	EXPECT_THAT(decoders[0].pulseWidths, testing::ElementsAre(100));
+	EXPECT_THAT(decoders[1].pulseWidths, testing::ElementsAre(100, 115));
+	EXPECT_THAT(decoders[2].pulseWidths, testing::ElementsAre(100));
+
+	// The port bit is released with the pin.
+	EXPECT_TRUE(scheduler.remove(&decoders[1]));
+	digitalWrite(kPins[1], HIGH);
+	scheduler.poll();
+	EXPECT_EQ(2u, decoders[1].pulseWidths.size());
+	EXPECT_TRUE(scheduler.remove(&decoders[0]));
+	EXPECT_TRUE(scheduler.remove(&decoders[2]));
+}
+#endif
+
+TEST(SchedulerTest, DecodeAndTransmitThreads)
+{
+	// Decoders in one thread pass each edge to transmit tasks in another thread.
+	// The main thread plays pin interrupts.
+	typedef Channel<uint32_t, 16> EdgeChannel;
+
+	class ForwardingDecoder : public Decoder
+	{
+		EdgeChannel &_channel;
+		uint32_t _edges = 0;
+	public:
+		ForwardingDecoder(EdgeChannel &channel) : _channel(channel) {}
+
+		uint16_t Decoder_pulse(uint8_t /*state*/, uint16_t /*pulseWidth*/) override
+		{
+			while (!_channel.send(_edges))
+				std::this_thread::yield();
+			++_edges;
+			return kInvalidTimeout;
+		}
+
+		void Decoder_timeout(uint8_t /*pinState*/) override {}
+	};
+
+	class CountingTask : public SteppedTask
+	{
+	public:
+		uint32_t steps = 0;
+		uint16_t SteppedTask_step() override { ++steps; return kInvalidDelta; }
+	};
+
+	resetLogs();
+	const uint8_t kPin = 2;
+	const uint32_t kEdges = 20000;
+	digitalWrite(kPin, LOW);
+	Scheduler decodeScheduler;
+	Scheduler transmitScheduler;
+	EdgeChannel channel(&transmitScheduler);
+	ForwardingDecoder decoder(channel);
+	EXPECT_TRUE(decodeScheduler.add(&decoder, kPin, true));
+
+	std::atomic<bool> done(false);
+	std::thread decodeThread([&]()
+	{
+		while (!done)
+		{
+			decodeScheduler.poll();
+			std::this_thread::yield();
+		}
+	});
+
+	uint32_t received = 0;
+	uint32_t outOfOrder = 0;
+	CountingTask task;
+	std::thread transmitThread([&]()
+	{
+		while (received < kEdges)
+		{
+			uint32_t edge;
+			while (channel.receive(edge))
+			{
+				if (edge != received)
+					++outOfOrder;
+				++received;
+				if (!transmitScheduler.active(&task))
+					transmitScheduler.add(&task);
+			}
+			transmitScheduler.poll();
+			std::this_thread::yield();
+		}
+	});
+
+	for (uint32_t i = 0; i < kEdges; ++i)
+	{
+		while (decodeScheduler.inputFIFO().full())
+			std::this_thread::yield();
+		digitalWrite(kPin, !g_pinStates[kPin]);
+	}
+
+	transmitThread.join();
+	done = true;
+	decodeThread.join();
+
+	EXPECT_EQ(kEdges, received);
+	EXPECT_EQ(0u, outOfOrder);
+	EXPECT_GT(task.steps, 0u);
+	EXPECT_EQ(0u, decodeScheduler.droppedEdges(kPin));
+	EXPECT_TRUE(decodeScheduler.remove(&decoder));
+	resetLogs();
+}
+
+#if INS_SCHEDULER_STATISTICS
+TEST(SchedulerTest, Statistics)
+{
+	class SlowDecoder : public Decoder
+	{
+	public:
+		uint16_t Decoder_pulse(uint8_t /*state*/, uint16_t /*pulseWidth*/) override
+		{
+			delayMicroseconds(7);
+			return 500;
+		}
+
+		void Decoder_timeout(uint8_t /*pinState*/) override {}
+	};
+
+	resetLogs();
+	const uint8_t kPin = 3;
+	digitalWrite(kPin, HIGH);
+	Scheduler scheduler;
+	PeriodicTask task(1000, 5);
+	SlowDecoder decoder;
+	task.statistics().reset();
+	decoder.statistics().reset();
+
+	EXPECT_TRUE(scheduler.add(&task));
+	EXPECT_TRUE(scheduler.add(&decoder, kPin));
+	delayMicroseconds(1);
+	runScheduler(scheduler, 1000);
+	digitalWrite(kPin, LOW);
+	runScheduler(scheduler, 9000);
+
+	// The first step is done by add().
+	const CallStatistics &taskStatistics = task.statistics();
+	EXPECT_EQ(4u, taskStatistics.calls);
+	EXPECT_EQ(0u, taskStatistics.maxMicros);
+	// Polls are 8 us after the step times due to the slow pulse.
+	EXPECT_EQ(4u, taskStatistics.lateness[4]);
+
+	// One pulse and one timeout.
+	const CallStatistics &decoderStatistics = decoder.statistics();
+	EXPECT_EQ(2u, decoderStatistics.calls);
+	EXPECT_EQ(7u, decoderStatistics.maxMicros);
+	EXPECT_EQ(7u, decoderStatistics.totalMicros);
+	EXPECT_EQ(1u, decoderStatistics.lateness[0]);
+
+	const CallStatistics &pollStatistics = scheduler.pollStatistics();
+	EXPECT_EQ(1000u, pollStatistics.calls);
+	EXPECT_EQ(7u, pollStatistics.maxMicros);
+	// 10 us between polls, 17 us after the slow pulse.
+	EXPECT_EQ(1u, pollStatistics.lateness[0]);
+	EXPECT_EQ(998u, pollStatistics.lateness[4]);
+	EXPECT_EQ(1u, pollStatistics.lateness[5]);
+
+	scheduler.resetStatistics();
+	EXPECT_EQ(0u, scheduler.pollStatistics().calls);
+}
+#endif
+
+TEST(SchedulerTest, NextDeadline)
+{
+	class TimeoutDecoder : public Decoder
+	{
+	public:
+		unsigned timeouts = 0;
+		uint16_t Decoder_pulse(uint8_t /*state*/, uint16_t /*pulseWidth*/) override { return 300; }
+		void Decoder_timeout(uint8_t /*pinState*/) override { ++timeouts; }
+	};
+
+	resetLogs();
+	const uint8_t kInterruptPin = 2;
+	const uint8_t kPolledPin = 3;
+	digitalWrite(kInterruptPin, LOW);
+	digitalWrite(kPolledPin, LOW);
+	Scheduler scheduler;
+	ins_micros_t deadline;
+	EXPECT_FALSE(scheduler.nextDeadline(deadline));
+
+	PeriodicTask task(1000, 2);
+	uint32_t start = micros();
+	EXPECT_TRUE(scheduler.addDelayed(&task, 500));
+	EXPECT_TRUE(scheduler.nextDeadline(deadline));
+	EXPECT_EQ(start + 500, deadline);
+
+	// Only interrupt pins, nothing to do until an edge arrives.
+	TimeoutDecoder decoder;
+	EXPECT_TRUE(scheduler.add(&decoder, kInterruptPin, true));
+	EXPECT_TRUE(scheduler.nextDeadline(deadline));
+	EXPECT_EQ(start + 500, deadline);
+
+	delayMicroseconds(100);
+	digitalWrite(kInterruptPin, HIGH);
+	EXPECT_TRUE(scheduler.nextDeadline(deadline));
+	EXPECT_EQ(start + 100, deadline);
+	scheduler.poll();
+	EXPECT_TRUE(scheduler.nextDeadline(deadline));
+	EXPECT_EQ(start + 100 + 300 + 1, deadline);
+
+	scheduler.waitUntilNextEvent();
+	EXPECT_EQ(start + 401, micros());
+	scheduler.poll();
+	EXPECT_EQ(1u, decoder.timeouts);
+
+	scheduler.waitUntilNextEvent();
+	EXPECT_EQ(start + 500, micros());
+	scheduler.poll();
+	EXPECT_EQ(1u, task.stepTimes.size());
+
+	scheduler.waitUntilNextEvent(100);
+	EXPECT_EQ(start + 600, micros());
+
+	// Polled inputs must be polled continuously.
+	TimeoutDecoder polled;
+	EXPECT_TRUE(scheduler.add(&polled, kPolledPin));
+	EXPECT_TRUE(scheduler.nextDeadline(deadline));
+	EXPECT_EQ(micros(), deadline);
+	scheduler.waitUntilNextEvent();
+	EXPECT_EQ(start + 600, micros());
+	EXPECT_TRUE(scheduler.remove(&polled));
+
+	scheduler.waitUntilNextEvent();
+	scheduler.poll();
+	EXPECT_EQ(2u, task.stepTimes.size());
+	EXPECT_EQ(start + 1500, task.stepTimes.back());
+	EXPECT_FALSE(scheduler.nextDeadline(deadline));
+}
@@ -0,0 +1,291 @@
+// Copyright (c) 2024 Daniel Wallner
+
+#include <gtest/gtest.h>
+#include <gmock/gmock.h>
+
+#include "Simulator.h"
+#include "../src/ProtocolBeo36.h"
+#include "../src/ProtocolDatalink80.h"
+#include "../src/ProtocolNEC.h"
+#include "../src/ProtocolRC5.h"
+#include "../src/ProtocolSIRC.h"
+
+#include <vector>
+
+using namespace inseparates;
+
+TEST(SimulatorTest, WiredAnd)
+{
+	Simulator simulator;
+	uint8_t bus = simulator.addWire({ 2, 3, 4 }, HIGH);
+	OpenDrainPinWriter writer2(2, LOW);
+	OpenDrainPinWriter writer3(3, LOW);
+	simulator.advance(1);
+	EXPECT_EQ(HIGH, simulator.wireLevel(bus));
+	EXPECT_EQ(HIGH, digitalRead(4));
+
+	writer2.write(LOW);
+	simulator.advance(1);
+	EXPECT_EQ(LOW, digitalRead(4));
+	writer3.write(LOW);
+	writer2.write(HIGH);
+	simulator.advance(1);
+	EXPECT_EQ(LOW, digitalRead(4));
+	writer3.write(HIGH);
+	simulator.advance(1);
+	EXPECT_EQ(HIGH, digitalRead(4));
+	// Two changes seen by three pins.
+	EXPECT_EQ(6u, simulator.edges());
+}
+
+TEST(SimulatorTest, RC5WithJitter)
+{
+	class Sender : public Scheduler::Delegate, public RxRC5::Delegate
+	{
+		Scheduler &_scheduler;
+		TxRC5 &_tx;
+	public:
+		std::vector<uint16_t> sent;
+		std::vector<uint16_t> received;
+
+		Sender(Scheduler &scheduler, TxRC5 &tx) : _scheduler(scheduler), _tx(tx) {}
+
+		void send()
+		{
+			uint16_t data = TxRC5::encodeRC5(sent.size() & 1, sent.size() % 32, sent.size() % 64);
+			sent.push_back(data);
+			_tx.prepare(data);
+			_scheduler.add(&_tx, this);
+		}
+
+		void SchedulerDelegate_done(SteppedTask */*task*/) override
+		{
+			if (sent.size() < 100)
+				send();
+		}
+
+		void RxRC5Delegate_data(uint16_t data, uint8_t /*bus*/) override
+		{
+			received.push_back(data);
+		}
+	};
+
+	Simulator simulator;
+	uint8_t wire = simulator.addWire({ 2, 3 });
+	simulator.setJitter(wire, 50);
+	simulator.setInterruptLatency(2, 20);
+	simulator.setPollInterval(5);
+
+	Scheduler scheduler;
+	PushPullPinWriter pinWriter(2);
+	TxRC5 tx(&pinWriter, HIGH);
+	Sender sender(scheduler, tx);
+	RxRC5 rx(HIGH, &sender);
+	EXPECT_TRUE(scheduler.add(&rx, 3, true));
+
+	sender.send();
+	EXPECT_TRUE(simulator.runUntil(scheduler, [&]() { return sender.received.size() == 100; }, 101 * 114000));
+	EXPECT_THAT(sender.received, testing::ElementsAreArray(sender.sent));
+	EXPECT_EQ(0u, scheduler.droppedEdges(3));
+}
+
+#if INS_SCHEDULER_STATISTICS
+TEST(SimulatorTest, ClassifySharedPin)
+{
+	class Sender : public Scheduler::Delegate, public RxNEC::Delegate, public RxSIRC::Delegate, public RxBeo36::Delegate
+	{
+		Scheduler &_scheduler;
+		TxNEC &_nec;
+		TxSIRC &_sirc;
+	public:
+		unsigned sent = 0;
+		std::vector<uint32_t> necReceived;
+		std::vector<uint32_t> sircReceived;
+		unsigned beo36Received = 0;
+
+		Sender(Scheduler &scheduler, TxNEC &nec, TxSIRC &sirc) : _scheduler(scheduler), _nec(nec), _sirc(sirc) {}
+
+		void send()
+		{
+			if (sent & 1)
+			{
+				_sirc.prepare(TxSIRC::encodeSIRC(0x01, sent & 0x7F), 12);
+				_scheduler.add(&_sirc, this);
+			}
+			else
+			{
+				_nec.prepare(TxNEC::encodeNEC(0x59, sent & 0xFF));
+				_scheduler.add(&_nec, this);
+			}
+			++sent;
+		}
+
+		void SchedulerDelegate_done(SteppedTask */*task*/) override
+		{
+			if (sent < 20)
+				send();
+		}
+
+		void RxNECDelegate_data(uint32_t data, uint8_t /*bus*/) override { necReceived.push_back(data); }
+		void RxSIRCDelegate_data(uint32_t data, uint8_t /*bits*/, uint8_t /*bus*/) override { sircReceived.push_back(data); }
+		void RxBeo36Delegate_data(uint8_t /*data*/, uint8_t /*bus*/) override { ++beo36Received; }
+	};
+
+	uint32_t calls[2];
+	for (bool classify : { false, true })
+	{
+		Simulator simulator;
+		uint8_t wire = simulator.addWire({ 2, 3 });
+		simulator.setJitter(wire, 30);
+		simulator.setInterruptLatency(2, 20);
+		simulator.setPollInterval(10);
+
+		Scheduler scheduler;
+		PushPullPinWriter pinWriter(2);
+		TxNEC nec(&pinWriter, HIGH);
+		TxSIRC sirc(&pinWriter, HIGH);
+		Sender sender(scheduler, nec, sirc);
+		RxNEC rxNEC(HIGH, &sender);
+		RxSIRC rxSIRC(HIGH, &sender);
+		RxBeo36 rxBeo36(HIGH, &sender);
+		EXPECT_TRUE(scheduler.add(&rxNEC, 3, true));
+		EXPECT_TRUE(scheduler.add(&rxSIRC, 3, true));
+		EXPECT_TRUE(scheduler.add(&rxBeo36, 3, true));
+		EXPECT_TRUE(scheduler.classify(3, classify));
+
+		sender.send();
+		simulator.run(scheduler, 10 * (110000 + 45000) + 50000);
+
+		std::vector<uint32_t> necExpected;
+		std::vector<uint32_t> sircExpected;
+		for (unsigned i = 0; i < 20; ++i)
+		{
+			if (i & 1)
+				sircExpected.push_back(TxSIRC::encodeSIRC(0x01, i & 0x7F));
+			else
+				necExpected.push_back(TxNEC::encodeNEC(0x59, i & 0xFF));
+		}
+		EXPECT_THAT(sender.necReceived, testing::ElementsAreArray(necExpected));
+		EXPECT_THAT(sender.sircReceived, testing::ElementsAreArray(sircExpected));
+		EXPECT_EQ(0u, sender.beo36Received);
+		calls[classify] = rxNEC.statistics().calls + rxSIRC.statistics().calls + rxBeo36.statistics().calls;
+	}
+	// Three decoders get every edge without classification, about one with.
+	EXPECT_LT(calls[1] * 2, calls[0]);
+}
+#endif
+
+#if INS_OUTPUT_STATISTICS
+TEST(SimulatorTest, InterruptWriteTiming)
+{
+	class Delegate : public RxRC5::Delegate, public Scheduler::Delegate
+	{
+	public:
+		std::vector<uint16_t> received;
+		unsigned sent = 0;
+
+		Delegate(InterruptWriteScheduler &scheduler, TxRC5 &tx) : _scheduler(scheduler), _tx(tx) {}
+
+		void send()
+		{
+			_tx.prepare(TxRC5::encodeRC5(1, 0x05, 0x35));
+			EXPECT_TRUE(_scheduler.add(&_tx, 2, this));
+			++sent;
+		}
+
+		void SchedulerDelegate_done(SteppedTask */*task*/) override
+		{
+			if (sent < 10)
+				send();
+		}
+
+		void RxRC5Delegate_data(uint16_t data, uint8_t /*bus*/) override { received.push_back(data); }
+
+	private:
+		InterruptWriteScheduler &_scheduler;
+		TxRC5 &_tx;
+	};
+
+	for (bool oneShot : { false, true })
+	{
+		Simulator simulator;
+		simulator.addWire({ 2, 3 });
+		simulator.setInterruptLatency(2, 20);
+		simulator.setPollInterval(50);
+
+		Scheduler scheduler;
+		InterruptWriteScheduler writeScheduler(30, oneShot);
+		InterruptPinWriter pinWriter(&writeScheduler, 2);
+		TxRC5 tx(&pinWriter, HIGH);
+		Delegate delegate(writeScheduler, tx);
+		RxRC5 rx(HIGH, &delegate);
+		EXPECT_TRUE(scheduler.add(&rx, 3, true));
+		EXPECT_TRUE(scheduler.add(&writeScheduler));
+		writeScheduler.begin();
+
+		// Re-add from the done callback, preparing the task while its frame is still queued would restart it.
+		delegate.send();
+		simulator.run(scheduler, 11 * 114000);
+		EXPECT_EQ(10u, delegate.received.size());
+
+		const OutputStatistics &statistics = pinWriter.statistics();
+		// 20 edges per frame.
+		EXPECT_EQ(10u * 20, statistics.edges);
+		if (oneShot)
+		{
+			EXPECT_EQ(0, statistics.minLateness);
+			EXPECT_EQ(0, statistics.maxLateness);
+		}
+		else
+		{
+			// Applied by the first timer interrupt within half an interval.
+			EXPECT_GE(statistics.minLateness, -15);
+			EXPECT_LE(statistics.maxLateness, 15);
+		}
+		EXPECT_GT(statistics.lowWater, 0u);
+		EXPECT_EQ(0u, scheduler.droppedEdges(3));
+	}
+}
+#endif
+
+TEST(SimulatorTest, Datalink80Collision)
+{
+	class Delegate : public RxDatalink80::Delegate
+	{
+	public:
+		std::vector<uint8_t> received;
+		void RxDatalink80Delegate_data(uint8_t data, uint8_t /*bus*/) override { received.push_back(data); }
+		void RxDatalink80Delegate_timingError() override {}
+	};
+
+	Simulator simulator;
+	simulator.addWire({ 2, 3, 4 }, HIGH);
+	simulator.setPollInterval(10);
+
+	Scheduler scheduler;
+	OpenDrainPinWriter writer2(2, LOW);
+	OpenDrainPinWriter writer3(3, LOW);
+	TxDatalink80 tx2(&writer2, LOW);
+	TxDatalink80 tx3(&writer3, LOW);
+	Delegate delegate;
+	RxDatalink80 rx(LOW, &delegate);
+	EXPECT_TRUE(scheduler.add(&rx, 4));
+
+	// One at a time.
+	tx2.prepare(0x12);
+	EXPECT_TRUE(scheduler.add(&tx2));
+	simulator.run(scheduler, 100000);
+	tx3.prepare(0x21);
+	EXPECT_TRUE(scheduler.add(&tx3));
+	simulator.run(scheduler, 100000);
+
+	// Collision, a one is low and low wins.
+	tx2.prepare(0x12);
+	tx3.prepare(0x21);
+	EXPECT_TRUE(scheduler.add(&tx2));
+	EXPECT_TRUE(scheduler.add(&tx3));
+	simulator.run(scheduler, 100000);
+
+	std::vector<uint8_t> expected { 0x12, 0x21, 0x33 };
+	EXPECT_THAT(delegate.received, testing::ElementsAreArray(expected));
+}
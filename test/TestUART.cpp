@@ -4,8 +4,11 @@
 #include <gmock/gmock.h>
 
 #include "../src/ProtocolUART.h"
+#include "Simulator.h"
 
 #include <array>
+#include <string>
+#include <vector>
 
 using namespace inseparates;
 
@@ -56,6 +59,59 @@ TEST(TxTest, UART)
 	EXPECT_EQ(1000, totalDelay());
 }
 
+TEST(TxTest, UARTBuffer)
+{
+	uint8_t pin = 3;
+	const uint8_t data[] = { 0x55, 0xFF, 0x00 };
+
+	resetLogs();
+	PushPullPinWriter pinWriter(pin);
+	TxUART tx(&pinWriter, HIGH);
+	tx.setBaudrate(10000);
+	tx.prepare(data, sizeof(data));
+	Scheduler::run(&tx);
+	std::array<uint8_t, 15> ws { 1, 0, 1, 0, 1, 0, 1, 0, 1, 0, 1, 0, 1, 0, 1 };
+	EXPECT_THAT(ws, testing::ElementsAreArray(g_digitalWriteStateLog[pin]));
+	// Each start bit directly follows the stop bit of the previous byte.
+	std::array<uint32_t, 15> wt { 0, 0, 100, 100, 100, 100, 100, 100, 100, 100, 100, 100, 100, 900, 900 };
+	EXPECT_THAT(wt, testing::ElementsAreArray(g_digitalWriteTimeLog[pin]));
+	EXPECT_EQ(3000, totalDelay());
+
+	// An empty buffer finishes at once without writing.
+	tx.prepare(data, 0);
+	resetLogs();
+	Scheduler::run(&tx);
+	EXPECT_TRUE(g_digitalWriteStateLog[pin].empty());
+	EXPECT_EQ(0, totalDelay());
+	tx.prepare(data, sizeof(data));
+
+	class Delegate : public RxUART::Delegate
+	{
+	public:
+		std::vector<uint8_t> received;
+		void RxUARTDelegate_data(uint8_t data_, uint8_t /*bus*/) override { received.push_back(data_); }
+		void RxUARTDelegate_timingError(uint8_t /*bus*/) override { FAIL() << "RxUARTDelegate_timingError"; }
+		void RxUARTDelegate_parityError(uint8_t /*bus*/) override { FAIL() << "RxUARTDelegate_parityError"; }
+	};
+
+	// Sent again with parity and two stop bits.
+	Delegate delegate;
+	RxUART rx(HIGH, &delegate);
+	rx.setBaudrate(10000);
+	rx.setFormat(Parity::kEven, 8);
+	tx.setFormat(Parity::kEven, 8, 2);
+	resetLogs();
+	delayMicroseconds(4321);
+	Scheduler::run(&tx);
+	EXPECT_EQ(3 * 1200 + 4321, totalDelay());
+	for (unsigned i = 0; i < g_digitalWriteStateLog[pin].size(); i++)
+	{
+		rx.Decoder_pulse(1 ^ g_digitalWriteStateLog[pin][i], g_digitalWriteTimeLog[pin][i]);
+	}
+	rx.Decoder_timeout(g_digitalWriteStateLog[pin].back());
+	EXPECT_THAT(delegate.received, testing::ElementsAreArray(data));
+}
+
 TEST(RxTest, UART)
 {
 	class Delegate : public RxUART::Delegate
@@ -161,3 +217,194 @@ TEST(RxTest, UART)
 	EXPECT_EQ(data, receivedData);
 	EXPECT_EQ(bus, receivedBus);
 }
+
+TEST(RxTest, UARTBuffer)
+{
+	typedef RxUARTBuffer<8> Buffer;
+	class Delegate : public Buffer::Delegate
+	{
+	public:
+		Buffer *buffer = nullptr;
+		bool consume = true;
+		std::vector<Buffer::Trigger> triggers;
+		std::vector<std::string> lines;
+		unsigned errors = 0;
+
+		void RxUARTBufferDelegate_data(Buffer::Trigger trigger, uint8_t /*bus*/) override
+		{
+			triggers.push_back(trigger);
+			if (!consume)
+				return;
+			std::string line;
+			for (uint16_t i = 0; i < buffer->available(); ++i)
+			{
+				line += char(buffer->peek(i));
+				errors += buffer->error(i);
+			}
+			buffer->pop(buffer->available());
+			lines.push_back(line);
+		}
+	};
+
+	Simulator simulator;
+	simulator.addWire({ 2, 3 });
+	simulator.setInterruptLatency(2, 10);
+	simulator.setPollInterval(10);
+
+	Scheduler scheduler;
+	PushPullPinWriter pinWriter(2);
+	TxUART tx(&pinWriter, HIGH);
+	tx.setBaudrate(9600);
+	Delegate delegate;
+	Buffer rx(HIGH, &delegate);
+	delegate.buffer = &rx;
+	rx.setBaudrate(9600);
+	rx.setTriggers(0, '\n', 3000);
+	// Let the line settle at idle first.
+	simulator.run(scheduler, 1000);
+	EXPECT_TRUE(scheduler.add(&rx, 3, true));
+
+	// Line terminator, then idle.
+	const char text[] = "AT\r\nOK";
+	tx.prepare((const uint8_t *)text, sizeof(text) - 1);
+	EXPECT_TRUE(scheduler.add(&tx));
+	simulator.run(scheduler, 20000);
+	std::vector<Buffer::Trigger> expectedTriggers { Buffer::kTriggerTerminator, Buffer::kTriggerIdle };
+	EXPECT_THAT(delegate.triggers, testing::ElementsAreArray(expectedTriggers));
+	std::vector<std::string> expectedLines { "AT\r\n", "OK" };
+	EXPECT_THAT(delegate.lines, testing::ElementsAreArray(expectedLines));
+	EXPECT_EQ(0u, delegate.errors);
+
+	// Byte count.
+	delegate.triggers.clear();
+	delegate.lines.clear();
+	rx.setTriggers(3);
+	tx.prepare((const uint8_t *)"abcdefg", 7);
+	EXPECT_TRUE(scheduler.add(&tx));
+	simulator.run(scheduler, 20000);
+	std::vector<std::string> expectedBlocks { "abc", "def" };
+	EXPECT_THAT(delegate.lines, testing::ElementsAreArray(expectedBlocks));
+	EXPECT_EQ(1u, rx.available());
+	EXPECT_EQ('g', rx.peek());
+	rx.clear();
+
+	// Full buffer, the rest is dropped.
+	delegate.triggers.clear();
+	delegate.consume = false;
+	rx.setTriggers(0);
+	tx.prepare((const uint8_t *)"0123456789", 10);
+	EXPECT_TRUE(scheduler.add(&tx));
+	simulator.run(scheduler, 20000);
+	std::vector<Buffer::Trigger> fullTriggers { Buffer::kTriggerFull };
+	EXPECT_THAT(delegate.triggers, testing::ElementsAreArray(fullTriggers));
+	EXPECT_EQ(8u, rx.available());
+	EXPECT_EQ(2u, rx.overflows());
+	EXPECT_EQ('0', rx.peek());
+	EXPECT_EQ('7', rx.peek(7));
+	rx.pop(6);
+	EXPECT_EQ('6', rx.peek());
+
+	// Parity errors are flagged per byte.
+	rx.clear();
+	rx.setFormat(Parity::kEven);
+	tx.setFormat(Parity::kOdd);
+	tx.prepare((const uint8_t *)"A", 1);
+	EXPECT_TRUE(scheduler.add(&tx));
+	simulator.run(scheduler, 20000);
+	EXPECT_EQ(1u, rx.available());
+	EXPECT_EQ('A', rx.peek());
+	EXPECT_TRUE(rx.error());
+
+	// A frame that ends in a timeout timing error is stored once.
+	rx.clear();
+	rx.setFormat(Parity::kNone);
+	rx.setBaudrate(10000);
+	// Start bit and two zeros, two ones, then the line drops again before the stop bit.
+	rx.Decoder_pulse(LOW, 300);
+	rx.Decoder_pulse(HIGH, 200);
+	rx.Decoder_timeout(LOW);
+	EXPECT_EQ(1u, rx.available());
+	EXPECT_EQ(0xFC, rx.peek());
+	EXPECT_TRUE(rx.error());
+}
+
+// Back to back bytes at each baud rate with simulated random interrupt latency.
+// The latencies are assumed, not measured on an ESP32.
+// Edges are timestamped in the pin interrupt, so only the variation of the latency matters.
+// An edge is accepted within 3/8 bit, that is 3.2 us at 115200 baud including 1 us timestamp resolution.
+// 115200 baud needs INS_UART_FRACTIONAL_TIME, 9 us bits drift too far from 8.68 us.
+TEST(RxTest, UARTErrorRate)
+{
+	class Delegate : public RxUART::Delegate
+	{
+	public:
+		std::vector<uint8_t> received;
+		unsigned errors = 0;
+		void RxUARTDelegate_data(uint8_t data, uint8_t /*bus*/) override { received.push_back(data); }
+		void RxUARTDelegate_timingError(uint8_t /*bus*/) override { ++errors; }
+		void RxUARTDelegate_parityError(uint8_t /*bus*/) override { ++errors; }
+	};
+
+	std::vector<uint8_t> data;
+	uint32_t random = 1;
+	for (unsigned i = 0; i < 512; ++i)
+	{
+		random = random * 1103515245 + 12345;
+		data.push_back(random >> 16);
+	}
+
+	struct Case
+	{
+		uint32_t baudRate;
+		uint16_t jitter;
+	};
+	std::vector<Case> cases { { 9600, 4 }, { 19200, 4 }, { 38400, 4 }, { 57600, 4 } };
+#if INS_UART_FRACTIONAL_TIME
+	cases.push_back({ 115200, 2 });
+#endif
+	for (Case c : cases)
+	{
+#if INS_SCHEDULER_STATISTICS
+		uint32_t calls[2];
+#endif
+		for (bool batch : { false, true })
+		{
+			Simulator simulator(c.baudRate);
+			simulator.addWire({ 2, 3 }, HIGH);
+			simulator.setInterruptLatency(1, 1 + c.jitter);
+			simulator.setPollInterval(20);
+
+			Scheduler scheduler;
+			// The timer interrupt keeps the output timing exact.
+			InterruptWriteScheduler writeScheduler(10, true);
+			InterruptPinWriter pinWriter(&writeScheduler, 2);
+			TxUART tx(&pinWriter, HIGH);
+			tx.setBaudrate(c.baudRate);
+			Delegate delegate;
+			RxUART rx(HIGH, &delegate);
+			rx.setBaudrate(c.baudRate);
+			EXPECT_TRUE(scheduler.add(&writeScheduler));
+			writeScheduler.begin();
+			EXPECT_TRUE(scheduler.add(&rx, 3, true));
+			EXPECT_TRUE(scheduler.batch(3, batch));
+
+			tx.prepare(data.data(), data.size());
+			EXPECT_TRUE(writeScheduler.add(&tx, 2));
+			simulator.run(scheduler, uint64_t(data.size() + 2) * 10 * 1000000 / c.baudRate);
+
+			EXPECT_EQ(0u, delegate.errors) << c.baudRate << " baud";
+			EXPECT_THAT(delegate.received, testing::ElementsAreArray(data)) << c.baudRate << " baud";
+			EXPECT_EQ(0u, scheduler.droppedEdges(3));
+#if INS_SCHEDULER_STATISTICS
+			calls[batch] = rx.statistics().calls;
+#endif
+		}
+#if INS_SCHEDULER_STATISTICS
+		// Several edges per poll at high baud rates.
+		if (c.baudRate >= 57600)
+		{
+			EXPECT_LT(calls[1], calls[0]);
+		}
+#endif
+	}
+}